@@ -0,0 +1,210 @@
+#include <httpverbs/httpverbs.h>
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <cstdlib>
+
+#include "../src/pooled_perform.h"
+#include "../src/connection_stats.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <poll.h>
+#endif
+
+httpverbs::enable_library _;
+
+using namespace std::chrono;
+
+static
+void wait_for(milliseconds ms)
+{
+#if defined(WIN32)
+	Sleep(static_cast<DWORD>(ms.count()));
+#else
+	poll(nullptr, 0, int(ms.count()));
+#endif
+}
+
+// the transfer loop used before curl_multi_poll, kept for comparison
+static
+CURLcode legacy_transfer(CURLM* multi)
+{
+	int without_fds = 0;
+	int still_running;
+
+	do
+	{
+		int ret;
+		auto before = high_resolution_clock::now();
+
+		if (curl_multi_wait(multi, nullptr, 0, 1000, &ret))
+			return CURLE_OUT_OF_MEMORY;
+
+		if (ret == -1)
+			return CURLE_RECV_ERROR;
+		else if (ret == 0)
+		{
+			auto after = high_resolution_clock::now();
+
+			if ((after - before) <= milliseconds(10))
+			{
+				++without_fds;
+
+				if (without_fds > 2)
+				{
+					if (without_fds < 10)
+						wait_for(milliseconds(
+						    1 << (without_fds - 1)));
+					else
+						wait_for(seconds(1));
+				}
+			}
+			else
+				without_fds = 0;
+		}
+		else
+			without_fds = 0;
+
+		if (curl_multi_perform(multi, &still_running))
+			return CURLE_OUT_OF_MEMORY;
+
+	} while (still_running);
+
+	int rc;
+	auto msg = curl_multi_info_read(multi, &rc);
+
+	return msg != nullptr ? msg->data.result : CURLE_OK;
+}
+
+static
+size_t discard(char*, size_t, size_t nmemb, void*)
+{
+	return nmemb;
+}
+
+// the same for both loops
+static
+CURL* new_handle(std::string const& url)
+{
+	auto h = curl_easy_init();
+	curl_easy_setopt(h, CURLOPT_URL, url.data());
+	curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, discard);
+
+	return h;
+}
+
+// the steps of pooled_perform, in the same pool, around the old loop
+static
+CURLcode legacy_perform(CURL* h)
+{
+	CURLcode r;
+
+	httpverbs::with_thread_pool([&](CURLM* multi)
+	    {
+		curl_easy_setopt(h, CURLOPT_SHARE, httpverbs::share_handle());
+		httpverbs::start_pool_transfer(multi, h);
+		curl_multi_add_handle(multi, h);
+		r = legacy_transfer(multi);
+		curl_multi_remove_handle(multi, h);
+		curl_easy_setopt(h, CURLOPT_SHARE, nullptr);
+		httpverbs::end_pool_transfer(h);
+	    });
+
+	return r;
+}
+
+template <typename Perform>
+static
+double time_get(std::string const& url, Perform perform)
+{
+	auto h = new_handle(url);
+	auto before = steady_clock::now();
+	perform(h);
+	auto after = steady_clock::now();
+	curl_easy_cleanup(h);
+
+	return duration<double, std::micro>(after - before).count();
+}
+
+static
+void report(char const* name, std::vector<double> v)
+{
+	std::sort(begin(v), end(v));
+
+	auto at = [&](double q)
+	{
+		return v[std::min(v.size() - 1, size_t(q * v.size()))];
+	};
+
+	std::cout << std::setw(8) << name << std::fixed
+	    << std::setprecision(0)
+	    << std::setw(10) << at(0.5)
+	    << std::setw(10) << at(0.99)
+	    << std::setw(10) << at(0.999)
+	    << std::setw(10) << v.back() << '\n';
+}
+
+int main(int argc, char* argv[])
+{
+	std::string url = argc > 1 ? argv[1] : "http://localhost:8080/";
+	int n = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+	std::vector<double> legacy, current;
+	legacy.reserve(n);
+	current.reserve(n);
+
+	auto run_legacy = [&]
+	    {
+		legacy.push_back(time_get(url, legacy_perform));
+	    };
+	auto run_current = [&]
+	    {
+		current.push_back(time_get(url, [](CURL* h)
+		    {
+			return httpverbs::pooled_perform(h);
+		    }));
+	    };
+
+	// connected, resolved, and paged in for both
+	for (int i = 0; i < 10; ++i)
+	{
+		run_legacy();
+		run_current();
+	}
+
+	legacy.clear();
+	current.clear();
+
+	// in turns, the first of each pair picked at random, so that
+	// neither gains from going first or from the drift of the host
+	std::mt19937 rng(std::random_device{}());
+
+	for (int i = 0; i < n; ++i)
+	{
+		if (rng() % 2)
+		{
+			run_legacy();
+			run_current();
+		}
+		else
+		{
+			run_current();
+			run_legacy();
+		}
+	}
+
+	std::cout << "latency of " << n << " GET " << url << " (us)\n"
+	    << "    loop       p50       p99     p99.9       max\n";
+	report("legacy", legacy);
+	report("current", current);
+}
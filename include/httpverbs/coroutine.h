@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HTTPVERBS_COROUTINE_H
+#define HTTPVERBS_COROUTINE_H
+
+#include "request.h"
+
+#include <coroutine>
+
+namespace httpverbs
+{
+
+// co_await req.perform_co() suspends the coroutine while the transfer
+// runs in the library's background event loop, and resumes it in the
+// loop's thread once the response is complete, so the coroutine should
+// move elsewhere before doing anything lengthy.  The request must
+// outlive the co_await.
+struct _perform_awaitable
+{
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		// the coroutine may be resumed, and this object gone,
+		// before start_on returns
+		auto done = [this, h](std::exception_ptr ep, response resp)
+		    {
+			ep_ = std::move(ep);
+			resp_ = std::move(resp);
+			h.resume();
+		    };
+
+		if (writer_)
+			req_->start_on(nullptr, body_, std::move(writer_),
+			    std::move(done));
+		else
+			req_->start_on(nullptr, body_, std::move(done));
+	}
+
+	response await_resume()
+	{
+		if (ep_)
+			std::rethrow_exception(ep_);
+
+		return std::move(resp_);
+	}
+
+private:
+	friend struct request;
+
+	_perform_awaitable(request* req, _mini_string_ref sv,
+	    request::callback_t writer) :
+		req_(req),
+		body_(sv),
+		writer_(std::move(writer))
+	{}
+
+	request* req_;
+	_mini_string_ref body_;
+	request::callback_t writer_;
+	std::exception_ptr ep_;
+	response resp_;
+};
+
+inline
+_perform_awaitable request::perform_co()
+{
+	return perform_co(keywords::data_from(content));
+}
+
+inline
+_perform_awaitable request::perform_co(callback_t writer)
+{
+	return perform_co(keywords::data_from(content), std::move(writer));
+}
+
+inline
+_perform_awaitable request::perform_co(_mini_string_ref sv)
+{
+	return _perform_awaitable(this, sv, nullptr);
+}
+
+inline
+_perform_awaitable request::perform_co(_mini_string_ref sv,
+    callback_t writer)
+{
+	return _perform_awaitable(this, sv, std::move(writer));
+}
+
+}
+
+#endif
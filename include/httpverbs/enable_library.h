@@ -26,20 +26,49 @@
 #ifndef HTTPVERBS_ENABLE__LIBRARY_H
 #define HTTPVERBS_ENABLE__LIBRARY_H
 
+#include "pool_options.h"
+
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstddef>
+
 namespace httpverbs
 {
 
+struct _library_state;
+
+// One may be nested in the scope of another: it takes over with its
+// own CA bundle, options and pools, and gives the outer one's back
+// when it goes.  The pools, the limits and the stats start over
+// either way, and the connections warmed by the outer one are not
+// warmed again until its next rewarm_interval.
 struct enable_library
 {
 	enable_library();
 	explicit enable_library(char const* ca_info);
+	explicit enable_library(pool_options const& opts);
+	enable_library(char const* ca_info, pool_options const& opts);
 	~enable_library();
 
 private:
 	enable_library(enable_library const&);  // = delete
 	enable_library& operator=(enable_library const&);  // = delete
+
+	_library_state* outer_;
 };
 
+// Opens `connections_per_host` connections to the host of each URL, by
+// as many HEAD requests at once, each given `timeout`, in the
+// background event loops' pools and in the blocking pool of the
+// calling thread.  With SHARED_CACHE, or without PER_THREAD_CACHE, the
+// latter serves the blocking requests of every thread; otherwise the
+// other threads get only the DNS entries and the TLS sessions.  Waits
+// for them, and returns the number the event loops' pools got.
+size_t warm_up(std::vector<std::string> const& urls,
+    long connections_per_host = 1,
+    std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
 }
 
 #endif
@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HTTPVERBS_ENGINE_H
+#define HTTPVERBS_ENGINE_H
+
+#include "request.h"
+
+namespace httpverbs
+{
+
+struct socket_engine;
+
+// An event loop run by the caller instead of a background thread.
+// start() only queues a transfer; the transfers make progress and
+// their futures become ready inside poll().  Apart from start(), an
+// engine is meant to be used by a single thread.
+struct engine
+{
+	engine();
+	~engine();
+
+	// the request must outlive the returned future becoming ready
+	std::future<response> start(request& req);
+	std::future<response> start(request& req, request::callback_t writer);
+	std::future<response> start(request& req, _mini_string_ref);
+	std::future<response> start(request& req, _mini_string_ref,
+	    request::callback_t writer);
+	std::future<response> start(request& req, request::length_t n,
+	    request::callback_t reader);
+	std::future<response> start(request& req, request::length_t n,
+	    request::callback_t reader, request::callback_t writer);
+
+	// waits up to `timeout_ms` (-1 for no limit) for socket activity
+	// or a libcurl timeout, and returns the number of transfers
+	// finished by this call
+	size_t poll(int timeout_ms);
+
+	// transfers started but not yet finished
+	size_t running() const;
+
+	// interrupts a poll() in progress; may be called from any thread
+	void wakeup();
+
+private:
+	friend struct request;
+
+	engine(engine const&);  // = delete
+	engine& operator=(engine const&);  // = delete
+
+	std::unique_ptr<socket_engine> impl_;
+};
+
+inline
+std::future<response> engine::start(request& req)
+{
+	return start(req, keywords::data_from(req.content));
+}
+
+inline
+std::future<response> engine::start(request& req, request::callback_t writer)
+{
+	return start(req, keywords::data_from(req.content), std::move(writer));
+}
+
+}
+
+#endif
@@ -49,6 +49,13 @@ struct bad_connection_pool : bad_request
 	char const* what() const NOEXCEPT;
 };
 
+// too many transfers in flight and in the queue
+struct would_block : std::exception
+{
+	would_block() {}
+	char const* what() const NOEXCEPT;
+};
+
 struct bad_response : std::runtime_error
 {
 	template <typename ErrorType>
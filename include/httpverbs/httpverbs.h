@@ -28,6 +28,9 @@
 
 #include "enable_library.h"
 #include "request.h"
+#include "engine.h"
+#include "cancellation.h"
+#include "stats.h"
 
 namespace httpverbs
 {
@@ -0,0 +1,271 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HTTPVERBS_POOL__OPTIONS_H
+#define HTTPVERBS_POOL__OPTIONS_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+
+namespace httpverbs
+{
+
+// A token bucket: `rate` requests per second on average, and up to
+// `burst` of them at once; a zero rate means unlimited.
+struct rate_limit
+{
+	rate_limit() :
+		rate(0),
+		burst(1)
+	{}
+
+	rate_limit(double r, double b) :
+		rate(r),
+		burst(b)
+	{}
+
+	double rate;
+	double burst;
+};
+
+// Retries of the failures which are likely to go away: a refused
+// connection, a reused connection dropped, 502, 503, 504 and 429.
+// Only the idempotent requests are retried, unless the request never
+// left, or it got a 429 and `retry_rejected` is set.  The delays are
+// decorrelated jitter between `base_delay` and `max_delay`, or longer
+// by Retry-After; a response asking to wait past `max_delay` is not
+// retried, nor is one past the deadline.  Each request earns the whole
+// process `budget` of a retry, and retries spend them, so that retries
+// can not multiply the load of a failing backend.  perform_all and
+// the hedged requests are not retried.  Regardless of the policy, a
+// request which meets a pooled connection closed by the server goes
+// once more at once, on a new connection, if it is safe to.
+struct retry_policy
+{
+	retry_policy() :
+		max_retries(0),
+		base_delay(50),
+		max_delay(2000),
+		budget(0.1),
+		min_budget(10),
+		retry_rejected(false)
+	{}
+
+	int max_retries;			// per request
+	std::chrono::milliseconds base_delay;
+	std::chrono::milliseconds max_delay;
+	double budget;
+	double min_budget;			// retries a second, regardless
+	bool retry_rejected;			// a 429, even if not idempotent
+};
+
+// Applied to every connection the pools open; zero leaves a setting
+// to the system, or to libcurl.  Larger buffers help the transfers on
+// links with a high bandwidth-delay product.  busy_poll is Linux only.
+struct socket_options
+{
+	socket_options() :
+		no_delay(true),
+		keepalive(false),
+		keepalive_idle(0),
+		keepalive_interval(0),
+		receive_buffer(0),
+		send_buffer(0),
+		busy_poll(0),
+		happy_eyeballs(0)
+	{}
+
+	bool no_delay;				// turns Nagle off
+	bool keepalive;
+	std::chrono::seconds keepalive_idle;
+	std::chrono::seconds keepalive_interval;
+	int receive_buffer;			// SO_RCVBUF, in bytes
+	int send_buffer;			// SO_SNDBUF
+	std::chrono::microseconds busy_poll;	// SO_BUSY_POLL
+	std::chrono::milliseconds happy_eyeballs;	// IPv6 head start
+};
+
+// Limits of a connection pool; 0 means unlimited.  A transfer which
+// can not get a connection under these limits waits in the pool until
+// one is released, rather than failing.
+struct pool_options
+{
+	enum balance
+	{
+		by_host,		// keeps a host's connections together
+		least_outstanding
+	};
+
+	enum overflow
+	{
+		wait_for_room,
+		fail_at_once		// throws would_block
+	};
+
+	// libcurl hard-coded ssl session cache to 8, so by default it
+	// doesn't help much to cache more connections
+	pool_options() :
+		max_connections(8),
+		max_host_connections(0),
+		max_total_connections(0),
+		max_idle_time(0),
+		max_connection_age(0),
+		max_idle_connections(0),
+		track_sockets(false),
+		multiplex(true),
+		max_transfers(0),
+		max_in_flight(0),
+		max_host_in_flight(0),
+		max_queued(-1),
+		when_full(wait_for_room),
+		adaptive_host_in_flight(false),
+		hedge_idempotent(false),
+		hedge_delay(0),
+		hedge_budget(0.1),
+		connect_timeout(0),
+		first_byte_timeout(0),
+		timeout(0),
+		low_speed_limit(0),
+		low_speed_time(0),
+		warm_connections(1),
+		warm_timeout(std::chrono::seconds(5)),
+		rewarm_interval(0),
+		resolve_interval(60),
+		event_loops(1),
+		pin_event_loops(false),
+		loop_balance(by_host)
+	{}
+
+	long max_connections;		// idle connections kept alive
+	long max_host_connections;	// connections to a single host
+	long max_total_connections;	// connections in use at once
+
+	// A connection idle for `max_idle_time` (zero leaves libcurl's
+	// 118 seconds), or open for `max_connection_age`, is not reused
+	// but closed.  A thread doing blocking transfers keeps its pool
+	// until it exits, so the pools untouched for `max_idle_time` are
+	// emptied; so are the least recently used ones while the pools
+	// not in use hold more than `max_idle_connections` in total.
+	// The pools are emptied by a thread of their own, and only with
+	// PER_THREAD_CACHE, but not SHARED_CACHE.  libcurl 7.65 and up
+	// for the idle time, 7.80 for the age.
+	std::chrono::seconds max_idle_time;
+	std::chrono::seconds max_connection_age;
+	long max_idle_connections;
+
+	// Counts the connections open and idle, and the TLS sessions
+	// resumed, for pool_connection_stats, by hooking the opening and
+	// closing of the sockets; otherwise those read zero.  Turned on
+	// by max_idle_connections too.  The resumptions are told by
+	// OpenSSL only, and only if it is linked in dynamically.
+	bool track_sockets;
+
+	// lets the HTTP/2 transfers to a host share one connection
+	bool multiplex;
+
+	// asynchronous transfers an event loop runs at once; the others
+	// wait in line by request::priority and request::deadline
+	long max_transfers;
+
+	// Asynchronous transfers the whole process runs at once, and to
+	// a single host.  Up to max_queued more (negative means no limit)
+	// may wait for them; a submission beyond that waits for room or
+	// fails, by `when_full`.  A request cancelled while waiting fails
+	// with bad_response.
+	long max_in_flight;
+	long max_host_in_flight;
+	long max_queued;
+	overflow when_full;
+
+	// Discovers each host's limit from the transfers to it: grows
+	// while its latency holds, shrinks as it climbs or on errors.
+	// max_host_in_flight, if set, becomes the upper bound.
+	bool adaptive_host_in_flight;
+
+	// Hedges the GET, HEAD and OPTIONS requests: with no response
+	// after `hedge_delay`, or the host's 95th percentile latency if
+	// zero, a duplicate goes out on a fresh connection, and the first
+	// to finish wins.  The duplicate counts towards the host's rate
+	// limit, and is not sent without a token before the deadline.
+	// Each request to a host earns it `hedge_budget` of a hedge, and
+	// a host may save up one, so that a slow host does not get all
+	// its requests twice.  Not for perform_all, nor for the bodies
+	// read or written by callbacks.
+	bool hedge_idempotent;
+	std::chrono::milliseconds hedge_delay;
+	double hedge_budget;
+
+	retry_policy retries;		// none by default
+
+	// The defaults of request::connect_timeout, first_byte_timeout,
+	// timeout and low_speed_limit; zero means none.
+	std::chrono::milliseconds connect_timeout;
+	std::chrono::milliseconds first_byte_timeout;
+	std::chrono::milliseconds timeout;
+	long low_speed_limit;
+	std::chrono::seconds low_speed_time;
+
+	// Connections enable_library opens to the hosts of `warm_urls`
+	// before returning; see warm_up for the pools they go to.  It
+	// waits at most `warm_timeout` for them.  Every
+	// `rewarm_interval`, if not zero, the event loops' pools and the
+	// blocking ones the threads share are topped up to as many again.
+	std::vector<std::string> warm_urls;
+	long warm_connections;		// to each
+	std::chrono::milliseconds warm_timeout;
+	std::chrono::seconds rewarm_interval;
+
+	// Host names looked up ahead, as "name:port", and handed to
+	// libcurl with each request to them, so that no request waits
+	// for DNS.  They are looked up again every `resolve_interval`
+	// (zero for never); a failed lookup keeps the old addresses.
+	// With a `resolve_file`, the addresses are saved there and
+	// loaded first at the next start, for the hosts still listed;
+	// enable_library looks up only the others before returning.
+	std::vector<std::string> resolve_hosts;
+	std::chrono::seconds resolve_interval;
+	std::string resolve_file;
+
+	socket_options sockets;
+
+	// The background threads serving the asynchronous requests, each
+	// driving a connection pool of its own.  A single loop tops out
+	// at one core.
+	unsigned event_loops;
+	bool pin_event_loops;		// loop i to CPU i; Linux only
+	balance loop_balance;		// how requests pick a loop
+
+	// Request rates by host name, shared by the whole process.  A
+	// request over its host's quota is held back until it fits,
+	// rather than failing.
+	rate_limit host_rate;		// for every host,
+	std::map<std::string, rate_limit> host_rates;	// but these
+};
+
+}
+
+#endif
@@ -27,17 +27,26 @@
 #define HTTPVERBS_REQUEST_H
 
 #include "response.h"
+#include "cancellation.h"
 
 #include <string>
+#include <vector>
 #include <memory>
+#include <iterator>
 #include <cstdint>
 #include <functional>
 #include <stdexcept>
+#include <future>
+#include <chrono>
+#include <exception>
 
 namespace httpverbs
 {
 
 struct _mini_string_ref;
+struct engine;
+struct _perform_awaitable;
+struct _completion;
 
 namespace keywords
 {
@@ -65,6 +74,10 @@ struct _mini_string_ref
 	size_t copy(char* s, size_t n) const;
 	void remove_prefix(size_t n);
 
+	// moves to `offset` from where the data started, so that a
+	// body can be sent again; false if out of range
+	bool seek(size_t offset);
+
 private:
 	friend _mini_string_ref keywords::data_from(char const*);
 	friend _mini_string_ref keywords::data_from(char const*, size_t);
@@ -73,11 +86,12 @@ private:
 	friend _mini_string_ref keywords::data_from(StringLike const&);
 
 	_mini_string_ref(char const* str, size_t len) :
-		it_(str), sz_(len)
+		it_(str), sz_(len), start_(str)
 	{}
 
 	char const* it_;
 	size_t sz_;
+	char const* start_;
 };
 
 struct request
@@ -89,11 +103,27 @@ private:
 	};
 
 	std::unique_ptr<void, _curl_handle_deleter> handle_;
+	int priority_;
+	std::chrono::steady_clock::time_point deadline_;
+	std::chrono::milliseconds timeout_;
+	std::chrono::milliseconds first_byte_timeout_;
+	std::shared_ptr<_cancellation_state> cancel_;
+	std::shared_ptr<void> resolve_;	// alive till the next transfer
+	bool idempotent_;
+	bool replayable_;		// the bodies are no callbacks
+	bool body_ignored_;
+	_mini_string_ref body_;
 
 public:
 	typedef std::function<size_t(char*, size_t)>	callback_t;
 	typedef long long				length_t;
 
+	// receives either a response or the exception explaining why
+	// there is none
+	typedef std::function<void(std::exception_ptr, response)>
+		completion_t;
+	typedef std::function<void(std::function<void()>)>	executor_t;
+
 	std::string url;
 	header_dict headers;
 	std::string content;
@@ -120,6 +150,47 @@ public:
 	request& allow_redirects();
 	request& ignore_response_body();
 
+	// HTTP/2 if the server agrees to it during the TLS handshake;
+	// cleartext URLs stay on HTTP/1.1
+	request& use_http2();
+
+	// HTTP/2 over cleartext without negotiation (h2c with prior
+	// knowledge), for servers known to speak it
+	request& use_h2c();
+
+	// the share of a multiplexed connection, from 1 to 256
+	request& stream_weight(long w);
+
+	// Marks the request safe to send more than once, so that it is
+	// retried and hedged like a GET.
+	request& idempotent();
+
+	// Where the request stands in line for a full event loop: higher
+	// priorities go first, and the earlier deadline within a
+	// priority.  A request not done by its deadline fails with a
+	// timeout, and one not started by then never takes a connection.
+	request& priority(int n);
+	request& deadline(std::chrono::steady_clock::time_point t);
+
+	// Time limits, failing the request with a timeout; zero means
+	// none.  `timeout` counts from each perform and spans the
+	// redirects and the retries, as if it were a deadline.  The
+	// first byte is that of the response, counted from the start of
+	// each attempt; past it, the rest of the time limit is checked as
+	// the response arrives, and the low speed limit catches one which
+	// stalls.  Defaults to those of pool_options.
+	request& connect_timeout(std::chrono::milliseconds d);
+	request& first_byte_timeout(std::chrono::milliseconds d);
+	request& timeout(std::chrono::milliseconds d);
+
+	// aborts a transfer slower than `bytes_per_second` for `period`
+	request& low_speed_limit(long bytes_per_second,
+	    std::chrono::seconds period);
+
+	// Fails the request with bad_response once `t` is cancelled,
+	// wherever it is; perform_all does not check it.
+	request& cancel_on(cancellation_token const& t);
+
 	response perform();
 	response perform(callback_t writer);
 	response perform(_mini_string_ref);
@@ -127,12 +198,62 @@ public:
 	response perform(length_t n, callback_t reader);
 	response perform(length_t n, callback_t reader, callback_t writer);
 
+	// returns at once; see keywords::on_complete
+	void perform(_completion);
+	void perform(callback_t writer, _completion);
+	void perform(_mini_string_ref, _completion);
+	void perform(_mini_string_ref, callback_t writer, _completion);
+	void perform(length_t n, callback_t reader, _completion);
+	void perform(length_t n, callback_t reader, callback_t writer,
+	    _completion);
+
+	// the request must outlive the returned future becoming ready
+	std::future<response> perform_async();
+	std::future<response> perform_async(callback_t writer);
+	std::future<response> perform_async(_mini_string_ref);
+	std::future<response> perform_async(_mini_string_ref,
+	    callback_t writer);
+	std::future<response> perform_async(length_t n, callback_t reader);
+	std::future<response> perform_async(length_t n, callback_t reader,
+	    callback_t writer);
+
+	// defined in <httpverbs/coroutine.h>, which needs C++20
+	_perform_awaitable perform_co();
+	_perform_awaitable perform_co(callback_t writer);
+	_perform_awaitable perform_co(_mini_string_ref);
+	_perform_awaitable perform_co(_mini_string_ref, callback_t writer);
+
 private:
+	friend std::vector<response> _perform_all(request** reqs, size_t n);
+	friend struct engine;
+	friend struct _perform_awaitable;
+
+	struct _transfer;
+	struct _hedge;
+
+	// called once, in the thread running the transfer
+	typedef completion_t _done_t;
+
+	// a null engine stands for the library's background event loop
+	void start_on(engine*, _mini_string_ref, _done_t);
+	void start_on(engine*, _mini_string_ref, callback_t writer, _done_t);
+	void start_on(engine*, length_t n, callback_t reader, _done_t);
+	void start_on(engine*, length_t n, callback_t reader,
+	    callback_t writer, _done_t);
+	static _done_t _fulfill(std::future<response>& fut);
+	static _done_t _dispatch(_completion c);
+
 	void setup_request_body_from_bytes(void* p, length_t n);
 	void setup_request_body_from_callback(void* p, length_t n);
 	void setup_response_body_to_string(void* p);
 	void setup_response_body_to_callback(void* p);
+	void setup_transfer(void* hl, void* sk);
 	void perform_on(response& resp);
+	std::chrono::steady_clock::time_point time_limit() const;
+	bool hedging() const;
+	void start_transfer(engine* e, std::shared_ptr<_transfer> t);
+	void start_hedged(engine* e, std::shared_ptr<_transfer> t,
+	    std::chrono::microseconds delay);
 };
 
 #if defined(_MSC_VER) && _MSC_VER < 1900
@@ -140,6 +261,16 @@ private:
 inline
 request::request(request&& other) :
 	handle_(std::move(other.handle_)),
+	priority_(other.priority_),
+	deadline_(other.deadline_),
+	timeout_(other.timeout_),
+	first_byte_timeout_(other.first_byte_timeout_),
+	cancel_(std::move(other.cancel_)),
+	resolve_(std::move(other.resolve_)),
+	idempotent_(other.idempotent_),
+	replayable_(other.replayable_),
+	body_ignored_(other.body_ignored_),
+	body_(other.body_),
 	url(std::move(other.url)),
 	headers(std::move(other.headers)),
 	content(std::move(other.content))
@@ -149,6 +280,16 @@ inline
 request& request::operator=(request&& other)
 {
 	handle_ = std::move(other.handle_);
+	priority_ = other.priority_;
+	deadline_ = other.deadline_;
+	timeout_ = other.timeout_;
+	first_byte_timeout_ = other.first_byte_timeout_;
+	cancel_ = std::move(other.cancel_);
+	resolve_ = std::move(other.resolve_);
+	idempotent_ = other.idempotent_;
+	replayable_ = other.replayable_;
+	body_ignored_ = other.body_ignored_;
+	body_ = other.body_;
 	url = std::move(other.url);
 	headers = std::move(other.headers);
 	content = std::move(other.content);
@@ -170,6 +311,57 @@ response request::perform(callback_t writer)
 	return perform(keywords::data_from(content), std::move(writer));
 }
 
+inline
+std::future<response> request::perform_async()
+{
+	return perform_async(keywords::data_from(content));
+}
+
+inline
+std::future<response> request::perform_async(callback_t writer)
+{
+	return perform_async(keywords::data_from(content), std::move(writer));
+}
+
+inline
+std::future<response> request::perform_async(_mini_string_ref sv)
+{
+	std::future<response> fut;
+	start_on(nullptr, sv, _fulfill(fut));
+
+	return fut;
+}
+
+inline
+std::future<response> request::perform_async(_mini_string_ref sv,
+    callback_t writer)
+{
+	std::future<response> fut;
+	start_on(nullptr, sv, std::move(writer), _fulfill(fut));
+
+	return fut;
+}
+
+inline
+std::future<response> request::perform_async(length_t n, callback_t reader)
+{
+	std::future<response> fut;
+	start_on(nullptr, n, std::move(reader), _fulfill(fut));
+
+	return fut;
+}
+
+inline
+std::future<response> request::perform_async(length_t n, callback_t reader,
+    callback_t writer)
+{
+	std::future<response> fut;
+	start_on(nullptr, n, std::move(reader), std::move(writer),
+	    _fulfill(fut));
+
+	return fut;
+}
+
 inline
 response request::perform(_mini_string_ref sv)
 {
@@ -220,6 +412,34 @@ response request::perform(length_t n, callback_t reader, callback_t writer)
 	return resp;
 }
 
+std::vector<response> _perform_all(request** reqs, size_t n);
+
+// runs the requests concurrently in the calling thread's connection
+// pool; the responses are in the order of the requests.  A request
+// which fails, or is past its deadline and never sent, does not stop
+// the others; the first failure is thrown once they are done.
+template <typename ForwardIt>
+inline
+std::vector<response> perform_all(ForwardIt first, ForwardIt last)
+{
+	std::vector<request*> v;
+
+	for (; first != last; ++first)
+		v.push_back(&*first);
+
+	return _perform_all(v.data(), v.size());
+}
+
+template <typename Range>
+inline
+std::vector<response> perform_all(Range& reqs)
+{
+	using std::begin;
+	using std::end;
+
+	return perform_all(begin(reqs), end(reqs));
+}
+
 namespace keywords
 {
 
@@ -244,6 +464,75 @@ _mini_string_ref data_from(StringLike const& str)
 
 }
 
+struct _completion
+{
+	request::completion_t handler;
+	request::executor_t executor;
+};
+
+namespace keywords
+{
+
+// The handler runs in the I/O thread unless an executor is given, in
+// which case the I/O thread only hands it over.  Either way it must
+// not throw.
+inline
+_completion on_complete(request::completion_t handler)
+{
+	_completion c = { std::move(handler), nullptr };
+
+	return c;
+}
+
+inline
+_completion on_complete(request::completion_t handler,
+    request::executor_t executor)
+{
+	_completion c = { std::move(handler), std::move(executor) };
+
+	return c;
+}
+
+}
+
+inline
+void request::perform(_completion c)
+{
+	perform(keywords::data_from(content), std::move(c));
+}
+
+inline
+void request::perform(callback_t writer, _completion c)
+{
+	perform(keywords::data_from(content), std::move(writer), std::move(c));
+}
+
+inline
+void request::perform(_mini_string_ref sv, _completion c)
+{
+	start_on(nullptr, sv, _dispatch(std::move(c)));
+}
+
+inline
+void request::perform(_mini_string_ref sv, callback_t writer, _completion c)
+{
+	start_on(nullptr, sv, std::move(writer), _dispatch(std::move(c)));
+}
+
+inline
+void request::perform(length_t n, callback_t reader, _completion c)
+{
+	start_on(nullptr, n, std::move(reader), _dispatch(std::move(c)));
+}
+
+inline
+void request::perform(length_t n, callback_t reader, callback_t writer,
+    _completion c)
+{
+	start_on(nullptr, n, std::move(reader), std::move(writer),
+	    _dispatch(std::move(c)));
+}
+
 inline
 size_t _mini_string_ref::copy(char* s, size_t n) const
 {
@@ -261,6 +550,20 @@ void _mini_string_ref::remove_prefix(size_t n)
 	sz_ -= n;
 }
 
+inline
+bool _mini_string_ref::seek(size_t offset)
+{
+	auto total = size_t(it_ - start_) + sz_;
+
+	if (offset > total)
+		return false;
+
+	it_ = start_ + offset;
+	sz_ = total - offset;
+
+	return true;
+}
+
 }
 
 #endif
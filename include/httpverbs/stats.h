@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HTTPVERBS_STATS_H
+#define HTTPVERBS_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace httpverbs
+{
+
+// The asynchronous transfers of the whole process, as seen by the
+// limits in pool_options.
+struct queue_stats
+{
+	size_t in_flight;		// running
+	size_t queued;			// submitted, not yet running
+	unsigned long long started;
+	std::chrono::nanoseconds total_wait;	// of the started ones
+	std::chrono::nanoseconds max_wait;
+};
+
+queue_stats transfer_queue_stats();
+
+// the transfers allowed in flight to `host` at the moment; 0 if
+// unlimited
+long host_in_flight_limit(std::string const& host);
+
+// the retries by pool_options::retries, those the budget refused,
+// and the requests sent once more after meeting a connection the
+// server had closed
+struct retry_stats
+{
+	unsigned long long retried;
+	unsigned long long denied;
+	unsigned long long replayed;
+};
+
+retry_stats transfer_retry_stats();
+
+// The connections of one pool to one host, the host of the request
+// URL (the redirects count towards it).  A pool is the connection
+// cache of a thread doing blocking transfers, of an event loop, or
+// of an engine; with SHARED_CACHE the threads doing blocking
+// transfers take turns with a few, and without PER_THREAD_CACHE they
+// share one.
+struct connection_stats
+{
+	enum pool_kind { per_thread, per_loop, shared };
+
+	unsigned pool;			// numbered as the pools are made
+	pool_kind kind;
+	std::string host;
+	size_t open;			// with pool_options::track_sockets
+	size_t idle;			// not running a transfer
+	unsigned long long created;
+	unsigned long long reused;
+	unsigned long long tls_handshakes;	// resumptions included
+	unsigned long long tls_resumed;	// as `open`, by OpenSSL only
+};
+
+// one entry for each pool alive and each host it has connected to
+std::vector<connection_stats> pool_connection_stats();
+
+}
+
+#endif
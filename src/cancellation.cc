@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "cancellation.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace httpverbs
+{
+
+cancellation_token::cancellation_token() :
+	state_(std::make_shared<_cancellation_state>())
+{}
+
+// the caller holds the lock through `lk`
+static
+void run_abort(_cancellation_state& st, std::unique_lock<std::mutex>& lk,
+    unsigned long long id)
+{
+	auto it = st.aborts.find(id);
+
+	if (it == st.aborts.end())
+		return;
+
+	auto abort = it->second;
+	auto me = st.running.emplace(id, std::this_thread::get_id());
+
+	lk.unlock();
+	abort();
+	lk.lock();
+
+	st.running.erase(me);
+	st.cv.notify_all();
+}
+
+void cancellation_token::cancel()
+{
+	auto&& st = *state_;
+	std::unique_lock<std::mutex> lk(st.mu);
+
+	if (st.cancelled)
+		return;
+
+	st.cancelled = true;
+	st.cv.notify_all();
+
+	std::vector<unsigned long long> ids;
+
+	for (auto&& a : st.aborts)
+		ids.push_back(a.first);
+
+	for (auto id : ids)
+		run_abort(st, lk, id);
+}
+
+bool cancellation_token::cancelled() const
+{
+	std::lock_guard<std::mutex> lk(state_->mu);
+
+	return state_->cancelled;
+}
+
+unsigned long long on_cancel(_cancellation_state& st,
+    std::function<void()> abort)
+{
+	std::lock_guard<std::mutex> lk(st.mu);
+
+	if (st.cancelled)
+		return 0;
+
+	auto id = st.next_id++;
+	st.aborts.emplace(id, std::move(abort));
+
+	return id;
+}
+
+void forget_cancel(_cancellation_state& st, unsigned long long id)
+{
+	std::unique_lock<std::mutex> lk(st.mu);
+	st.aborts.erase(id);
+
+	// unless the abort itself got here
+	auto me = std::this_thread::get_id();
+	st.cv.wait(lk, [&]
+	    {
+		auto r = st.running.equal_range(id);
+
+		return std::all_of(r.first, r.second,
+		    [&](std::pair<unsigned long long const,
+		        std::thread::id> const& x)
+		    {
+			return x.second == me;
+		    });
+	    });
+}
+
+void recheck_cancel(_cancellation_state& st, unsigned long long id)
+{
+	std::unique_lock<std::mutex> lk(st.mu);
+
+	if (st.cancelled)
+		run_abort(st, lk, id);
+}
+
+bool sleep_until(_cancellation_state* st,
+    std::chrono::steady_clock::time_point t)
+{
+	if (st == nullptr)
+	{
+		std::this_thread::sleep_until(t);
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lk(st->mu);
+
+	return not st->cv.wait_until(lk, t, [=]
+	    {
+		return st->cancelled;
+	    });
+}
+
+}
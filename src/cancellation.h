@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_CANCELLATION_H
+#define _HTTPVERBS_CANCELLATION_H
+
+#include <httpverbs/cancellation.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace httpverbs
+{
+
+struct _cancellation_state
+{
+	_cancellation_state() :
+		cancelled(false),
+		next_id(1)
+	{}
+
+	std::mutex mu;
+	std::condition_variable cv;
+	bool cancelled;
+	unsigned long long next_id;
+	std::map<unsigned long long, std::function<void()>> aborts;
+	std::multimap<unsigned long long, std::thread::id> running;
+};
+
+// Runs `abort` on cancellation.  It runs without the token's lock, as
+// it may take others, but it never runs after forget_cancel returns;
+// forget_cancel waits for it if it is running in another thread.
+// Returns 0, without running it, if the token is cancelled already.
+unsigned long long on_cancel(_cancellation_state& st,
+    std::function<void()> abort);
+void forget_cancel(_cancellation_state& st, unsigned long long id);
+
+// runs the abort again if cancelled, for a transfer submitted after
+// the cancellation went looking for it
+void recheck_cancel(_cancellation_state& st, unsigned long long id);
+
+// sleeps until `t`; false if cancelled first
+bool sleep_until(_cancellation_state* st,
+    std::chrono::steady_clock::time_point t);
+
+}
+
+#endif
@@ -0,0 +1,468 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "connection_stats.h"
+#include "rate_limiter.h"
+#include "pool_config.h"
+
+#if defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#endif
+
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+namespace httpverbs
+{
+
+namespace
+{
+
+struct tally
+{
+	tally() :
+		open(0),
+		busy(0),
+		created(0),
+		reused(0),
+		tls_handshakes(0),
+		tls_resumed(0)
+	{}
+
+	size_t open;
+	size_t busy;			// transfers running
+	unsigned long long created;
+	unsigned long long reused;
+	unsigned long long tls_handshakes;
+	unsigned long long tls_resumed;
+};
+
+struct running_transfer
+{
+	tally* to;
+	bool resumed;
+	bool hooked;
+};
+
+// `to` is null once its pool is gone
+struct tracked_socket
+{
+	tally* to;
+	curl_closesocket_callback close;
+	void* close_data;
+};
+
+// The tallies are keyed by the pool number rather than the multi
+// handle, so that a new pool at the address of a dead one starts
+// afresh.  The sockets remember the tally of the pool and the host
+// which opened them; libcurl may close them when driving another
+// transfer, or none.
+struct registry
+{
+	registry() :
+		next_pool(0)
+	{}
+
+	std::mutex mu;
+	unsigned next_pool;
+	std::unordered_map<CURLM*, unsigned> pools;
+	std::map<unsigned, connection_stats::pool_kind> kinds;
+	std::map<std::pair<unsigned, std::string>, tally> tallies;
+	std::unordered_map<CURL*, running_transfer> running;
+	std::unordered_map<curl_socket_t, tracked_socket> sockets;
+	std::unordered_map<CURL*, socket_callbacks> chained;
+};
+
+// leaked on purpose, since libcurl may close the sockets of a pool
+// left to a static destructor
+registry& the_registry()
+{
+	static auto p = new registry;
+
+	return *p;
+}
+
+socket_callbacks chained_to(CURL* handle)
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	auto it = reg.chained.find(handle);
+
+	if (it == reg.chained.end())
+		return socket_callbacks();
+
+	return it->second;
+}
+
+// the counts of open and idle connections need the hooks, and so
+// does the reaper, which counts the idle ones
+bool track_sockets()
+{
+	return pool_config().track_sockets or
+	    pool_config().max_idle_connections != 0;
+}
+
+curl_socket_t open_socket(void* p, curlsocktype purpose,
+    curl_sockaddr* addr)
+{
+	auto handle = static_cast<CURL*>(p);
+	auto cbs = chained_to(handle);
+	curl_socket_t fd;
+
+	if (cbs.open != nullptr)
+		fd = cbs.open(cbs.open_data, purpose, addr);
+	else
+	{
+		auto socktype = addr->socktype;
+
+#if defined(SOCK_CLOEXEC)
+		socktype |= SOCK_CLOEXEC;
+#endif
+
+		fd = socket(addr->family, socktype, addr->protocol);
+	}
+
+	if (fd == CURL_SOCKET_BAD)
+		return fd;
+
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	tracked_socket ts = { nullptr, cbs.close, cbs.close_data };
+	auto it = reg.running.find(handle);
+
+	if (it != reg.running.end() and purpose == CURLSOCKTYPE_IPCXN)
+	{
+		++it->second.to->open;
+		ts.to = it->second.to;
+	}
+
+	if (ts.to != nullptr or ts.close != nullptr)
+		reg.sockets[fd] = ts;
+
+	return fd;
+}
+
+int close_socket(void*, curl_socket_t fd)
+{
+	tracked_socket ts = {};
+
+	{
+		auto&& reg = the_registry();
+		std::lock_guard<std::mutex> lk(reg.mu);
+		auto it = reg.sockets.find(fd);
+
+		if (it != reg.sockets.end())
+		{
+			ts = it->second;
+
+			if (ts.to != nullptr)
+				--ts.to->open;
+
+			reg.sockets.erase(it);
+		}
+	}
+
+	if (ts.close != nullptr)
+		return ts.close(ts.close_data, fd);
+
+#if defined(WIN32)
+	return closesocket(fd);
+#else
+	return close(fd);
+#endif
+}
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+
+// libcurl does not tell whether a TLS session was resumed, but
+// OpenSSL does, if it is linked in dynamically
+bool session_reused(CURL* handle)
+{
+#if !defined(WIN32)
+	typedef int (*query)(void const*);
+	static auto reused = reinterpret_cast<query>(
+	    dlsym(RTLD_DEFAULT, "SSL_session_reused"));
+
+	curl_tlssessioninfo* info;
+
+	if (reused == nullptr or
+	    curl_easy_getinfo(handle, CURLINFO_TLS_SSL_PTR, &info) or
+	    info->backend != CURLSSLBACKEND_OPENSSL or
+	    info->internals == nullptr)
+		return false;
+
+	return reused(info->internals) == 1;
+#else
+	(void)handle;
+	return false;
+#endif
+}
+
+// on a connection ready to send the request
+int check_session(void* p, char* conn_primary_ip, char* conn_local_ip,
+    int conn_primary_port, int conn_local_port)
+{
+	auto handle = static_cast<CURL*>(p);
+
+	if (session_reused(handle))
+	{
+		auto&& reg = the_registry();
+		std::lock_guard<std::mutex> lk(reg.mu);
+		auto it = reg.running.find(handle);
+
+		if (it != reg.running.end())
+			it->second.resumed = true;
+	}
+
+	auto cbs = chained_to(handle);
+
+	if (cbs.prereq != nullptr)
+		return cbs.prereq(cbs.prereq_data, conn_primary_ip,
+		    conn_local_ip, conn_primary_port, conn_local_port);
+
+	return CURL_PREREQFUNC_OK;
+}
+
+#endif
+
+}
+
+void add_pool(CURLM* multi, connection_stats::pool_kind kind)
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	auto n = reg.next_pool++;
+
+	reg.pools[multi] = n;
+	reg.kinds[n] = kind;
+}
+
+void forget_pool(CURLM* multi)
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	auto it = reg.pools.find(multi);
+
+	if (it == reg.pools.end())
+		return;
+
+	auto n = it->second;
+	reg.pools.erase(it);
+	reg.kinds.erase(n);
+
+	// what is left open lives in the share handle
+	auto first = reg.tallies.lower_bound(std::make_pair(n,
+	    std::string()));
+	auto last = reg.tallies.lower_bound(std::make_pair(n + 1,
+	    std::string()));
+
+	for (auto st = reg.sockets.begin(); st != reg.sockets.end();)
+	{
+		for (auto t = first; t != last; ++t)
+			if (st->second.to == &t->second)
+				st->second.to = nullptr;
+
+		if (st->second.to == nullptr and st->second.close == nullptr)
+			st = reg.sockets.erase(st);
+		else
+			++st;
+	}
+
+	reg.tallies.erase(first, last);
+}
+
+void start_pool_transfer(CURLM* multi, CURL* handle)
+{
+	char* url = nullptr;
+	curl_easy_getinfo(handle, CURLINFO_PRIVATE, &url);
+
+	auto host = url != nullptr ?
+	    url_host(*reinterpret_cast<std::string*>(url)) : std::string();
+
+	{
+		auto&& reg = the_registry();
+		std::lock_guard<std::mutex> lk(reg.mu);
+		auto it = reg.pools.find(multi);
+
+		if (it == reg.pools.end())
+			return;
+
+		auto&& t = reg.tallies[std::make_pair(it->second,
+		    std::move(host))];
+		++t.busy;
+
+		running_transfer rt = { &t, false, track_sockets() };
+		reg.running[handle] = rt;
+
+		if (not rt.hooked)
+			return;
+	}
+
+	curl_easy_setopt(handle, CURLOPT_OPENSOCKETFUNCTION, open_socket);
+	curl_easy_setopt(handle, CURLOPT_OPENSOCKETDATA, handle);
+	curl_easy_setopt(handle, CURLOPT_CLOSESOCKETFUNCTION, close_socket);
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+	curl_easy_setopt(handle, CURLOPT_PREREQFUNCTION, check_session);
+	curl_easy_setopt(handle, CURLOPT_PREREQDATA, handle);
+#endif
+}
+
+void end_pool_transfer(CURL* handle)
+{
+	long connects = 0;
+	char* ip = nullptr;
+	double tls_time = 0;
+
+	curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(handle, CURLINFO_PRIMARY_IP, &ip);
+	curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &tls_time);
+
+	auto&& reg = the_registry();
+	std::unique_lock<std::mutex> lk(reg.mu);
+	auto it = reg.running.find(handle);
+
+	if (it == reg.running.end())
+		return;
+
+	auto&& t = *it->second.to;
+	auto hooked = it->second.hooked;
+	--t.busy;
+	t.created += (unsigned long long)connects;
+
+	// a transfer may fail before it gets any connection
+	if (connects == 0 and ip != nullptr and *ip != '\0')
+		++t.reused;
+
+	if (connects > 0 and tls_time > 0)
+	{
+		++t.tls_handshakes;
+
+		if (it->second.resumed)
+			++t.tls_resumed;
+	}
+
+	reg.running.erase(it);
+	lk.unlock();
+
+	if (not hooked)
+		return;
+
+	auto cbs = chained_to(handle);
+
+	curl_easy_setopt(handle, CURLOPT_OPENSOCKETFUNCTION, cbs.open);
+	curl_easy_setopt(handle, CURLOPT_OPENSOCKETDATA, cbs.open_data);
+	curl_easy_setopt(handle, CURLOPT_CLOSESOCKETFUNCTION, cbs.close);
+	curl_easy_setopt(handle, CURLOPT_CLOSESOCKETDATA, cbs.close_data);
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+	curl_easy_setopt(handle, CURLOPT_PREREQFUNCTION, cbs.prereq);
+	curl_easy_setopt(handle, CURLOPT_PREREQDATA, cbs.prereq_data);
+#endif
+}
+
+void chain_socket_callbacks(CURL* handle, socket_callbacks const* cbs)
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+
+	if (cbs != nullptr)
+		reg.chained[handle] = *cbs;
+	else
+		reg.chained.erase(handle);
+}
+
+size_t idle_connections(CURLM* multi)
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	auto it = reg.pools.find(multi);
+
+	if (it == reg.pools.end())
+		return 0;
+
+	auto n = it->second;
+	auto first = reg.tallies.lower_bound(std::make_pair(n,
+	    std::string()));
+	auto last = reg.tallies.lower_bound(std::make_pair(n + 1,
+	    std::string()));
+	size_t idle = 0;
+
+	for (; first != last; ++first)
+	{
+		auto&& t = first->second;
+
+		if (t.open > t.busy)
+			idle += t.open - t.busy;
+	}
+
+	return idle;
+}
+
+void reset_connection_stats()
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+
+	for (auto&& t : reg.tallies)
+	{
+		t.second.created = 0;
+		t.second.reused = 0;
+		t.second.tls_handshakes = 0;
+		t.second.tls_resumed = 0;
+	}
+}
+
+// An open connection counts as idle unless a transfer to its host is
+// running in the pool; multiplexed transfers may share one connection
+// and leave another idle, which is not told apart.
+std::vector<connection_stats> pool_connection_stats()
+{
+	auto&& reg = the_registry();
+	std::lock_guard<std::mutex> lk(reg.mu);
+	std::vector<connection_stats> v;
+	v.reserve(reg.tallies.size());
+
+	for (auto&& t : reg.tallies)
+	{
+		auto&& n = t.second;
+		connection_stats st = { t.first.first,
+		    reg.kinds[t.first.first], t.first.second, n.open,
+		    n.open > n.busy ? n.open - n.busy : 0, n.created,
+		    n.reused, n.tls_handshakes, n.tls_resumed };
+		v.push_back(std::move(st));
+	}
+
+	return v;
+}
+
+}
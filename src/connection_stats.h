@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_CONNECTION__STATS_H
+#define _HTTPVERBS_CONNECTION__STATS_H
+
+#include <httpverbs/stats.h>
+
+#include <curl/curl.h>
+
+namespace httpverbs
+{
+
+// The multi handles made by new_multi_handle register as pools, and
+// drop out with their connections after curl_multi_cleanup.
+void add_pool(CURLM* multi, connection_stats::pool_kind kind);
+void forget_pool(CURLM* multi);
+
+// Brackets a transfer of `handle` in `multi`, from right before
+// curl_multi_add_handle to right after curl_multi_remove_handle.
+// The handle's CURLOPT_PRIVATE points to the URL.  With
+// pool_options::track_sockets, or max_idle_connections, the handle's
+// socket callbacks are hooked for the transfer.
+void start_pool_transfer(CURLM* multi, CURL* handle);
+void end_pool_transfer(CURL* handle);
+
+// The socket callbacks of a handle, which libcurl does not tell, so
+// the code setting its own on a handle tells them here too; the hooks
+// call on to them, and give them back after the transfer.
+struct socket_callbacks
+{
+	curl_opensocket_callback open;
+	void* open_data;
+	curl_closesocket_callback close;
+	void* close_data;
+#if LIBCURL_VERSION_NUM >= 0x075000
+	curl_prereq_callback prereq;
+	void* prereq_data;
+#endif
+};
+
+// nullptr forgets them
+void chain_socket_callbacks(CURL* handle, socket_callbacks const* cbs);
+
+// the connections of `multi` open, but running no transfer
+size_t idle_connections(CURLM* multi);
+
+// zeroes the counters, but not the connections open
+void reset_connection_stats();
+
+}
+
+#endif
@@ -0,0 +1,375 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "dns_cache.h"
+#include "rate_limiter.h"
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+#if defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+namespace httpverbs
+{
+
+namespace
+{
+
+typedef std::shared_ptr<curl_slist> pinned_list;
+
+// by "name:port"
+struct dns_cache
+{
+	std::mutex mu;
+	std::map<std::string, std::string> addresses;
+	std::map<std::string, pinned_list> pins;
+};
+
+dns_cache& the_cache()
+{
+	static auto p = new dns_cache;
+
+	return *p;
+}
+
+void pin(std::string const& key, std::string const& addrs)
+{
+	auto entry = key + ':' + addrs;
+	auto ls = pinned_list(curl_slist_append(nullptr, entry.data()),
+	    curl_slist_free_all);
+
+	if (ls == nullptr)
+		return;
+
+	auto&& c = the_cache();
+	std::lock_guard<std::mutex> lk(c.mu);
+
+	c.addresses[key] = addrs;
+	c.pins[key] = std::move(ls);
+}
+
+bool pinned(std::string const& key)
+{
+	auto&& c = the_cache();
+	std::lock_guard<std::mutex> lk(c.mu);
+
+	return c.pins.count(key) != 0;
+}
+
+// the addresses, comma-separated, of "name:port"; empty on failure
+std::string look_up(std::string const& key)
+{
+	auto colon = key.rfind(':');
+
+	if (colon == std::string::npos)
+		return std::string();
+
+	auto name = key.substr(0, colon);
+	auto port = key.substr(colon + 1);
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* res;
+
+	if (getaddrinfo(name.data(), port.data(), &hints, &res) != 0)
+		return std::string();
+
+	std::string addrs;
+
+	for (auto p = res; p != nullptr; p = p->ai_next)
+	{
+		char buf[INET6_ADDRSTRLEN];
+		void* a;
+
+		if (p->ai_family == AF_INET)
+			a = &reinterpret_cast<sockaddr_in*>(
+			    p->ai_addr)->sin_addr;
+		else if (p->ai_family == AF_INET6)
+			a = &reinterpret_cast<sockaddr_in6*>(
+			    p->ai_addr)->sin6_addr;
+		else
+			continue;
+
+		if (inet_ntop(p->ai_family, a, buf, sizeof(buf)) == nullptr)
+			continue;
+
+		if (not addrs.empty())
+		{
+#if LIBCURL_VERSION_NUM >= 0x073b00
+			addrs += ',';
+#else
+			// one address per entry before libcurl 7.59
+			break;
+#endif
+		}
+
+		if (p->ai_family == AF_INET6)
+			addrs.append("[").append(buf).append("]");
+		else
+			addrs.append(buf);
+	}
+
+	freeaddrinfo(res);
+
+	return addrs;
+}
+
+// as url_host has it
+std::string lowered(std::string key)
+{
+	for (auto&& c : key)
+		c = char(std::tolower((unsigned char)c));
+
+	return key;
+}
+
+// one "name:port:addresses" a line; the hosts no longer asked for
+// are left out
+void load(std::string const& fn, std::vector<std::string> const& hosts)
+{
+	std::ifstream in(fn);
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		auto i = line.find(':');
+		auto j = i == std::string::npos ? i : line.find(':', i + 1);
+
+		if (j == std::string::npos or j + 1 == line.size())
+			continue;
+
+		auto key = lowered(line.substr(0, j));
+
+		if (std::find(hosts.begin(), hosts.end(), key) != hosts.end())
+			pin(key, line.substr(j + 1));
+	}
+}
+
+// replaces the file at once, so that a crash leaves the old one
+void save(std::string const& fn)
+{
+	auto tmp = fn + ".tmp";
+
+	{
+		std::ofstream out(tmp, std::ios::trunc);
+		auto&& c = the_cache();
+		std::lock_guard<std::mutex> lk(c.mu);
+
+		for (auto&& kv : c.addresses)
+			out << kv.first << ':' << kv.second << '\n';
+
+		if (not out.flush())
+			return;
+	}
+
+#if defined(WIN32)
+	// which does not rename over a file
+	std::remove(fn.data());
+#endif
+	std::rename(tmp.data(), fn.data());
+}
+
+void refresh(std::vector<std::string> const& hosts, std::string const& fn)
+{
+	for (auto&& key : hosts)
+	{
+		auto addrs = look_up(key);
+
+		if (not addrs.empty())
+			pin(key, addrs);
+	}
+
+	if (not fn.empty())
+		save(fn);
+}
+
+struct refresher
+{
+	refresher(std::vector<std::string> const& hosts,
+	    pool_options const& opts, bool at_once) :
+		hosts_(hosts),
+		fn_(opts.resolve_file),
+		interval_(opts.resolve_interval),
+		at_once_(at_once),
+		stopping_(false),
+		thr_(&refresher::run, this)
+	{}
+
+	~refresher()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu_);
+			stopping_ = true;
+		}
+
+		cv_.notify_one();
+		thr_.join();
+	}
+
+private:
+	void run()
+	{
+		if (at_once_)
+			refresh(hosts_, fn_);
+
+		std::unique_lock<std::mutex> lk(mu_);
+
+		while (not cv_.wait_for(lk, interval_, [&]
+		    {
+			return stopping_;
+		    }))
+		{
+			lk.unlock();
+			refresh(hosts_, fn_);
+			lk.lock();
+		}
+	}
+
+	std::vector<std::string> hosts_;
+	std::string fn_;
+	std::chrono::seconds interval_;
+	bool at_once_;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	bool stopping_;
+	std::thread thr_;
+};
+
+refresher* the_refresher;
+
+// the port in the URL, or the scheme's
+std::string url_port(std::string const& url)
+{
+	auto i = url.find("://");
+	auto scheme = i == std::string::npos ? std::string("http") :
+	    url.substr(0, i);
+	i = i == std::string::npos ? 0 : i + 3;
+
+	auto j = url.find_first_of("/?#", i);
+
+	if (j == std::string::npos)
+		j = url.size();
+
+	auto at = url.rfind('@', j);
+
+	if (at != std::string::npos and at >= i)
+		i = at + 1;
+
+	auto k = url[i] == '[' ? url.find(']', i) : i;
+
+	if (k == std::string::npos or k > j)
+		k = i;
+
+	auto colon = url.find(':', k);
+
+	if (colon != std::string::npos and colon + 1 < j)
+		return url.substr(colon + 1, j - colon - 1);
+
+	return scheme.size() == 5 and (scheme[4] == 's' or
+	    scheme[4] == 'S') ? "443" : "80";
+}
+
+}
+
+void start_dns_cache(pool_options const& opts)
+{
+	if (opts.resolve_hosts.empty())
+		return;
+
+	// matched against url_host, which lowercases
+	std::vector<std::string> hosts;
+
+	for (auto&& key : opts.resolve_hosts)
+		hosts.push_back(lowered(key));
+
+	if (not opts.resolve_file.empty())
+		load(opts.resolve_file, hosts);
+
+	// the saved addresses serve while the background looks them up
+	std::vector<std::string> cold;
+
+	for (auto&& key : hosts)
+		if (not pinned(key))
+			cold.push_back(key);
+
+	refresh(cold, opts.resolve_file);
+
+	if (opts.resolve_interval.count() == 0)
+		return;
+
+	delete the_refresher;
+	the_refresher = new refresher(hosts, opts,
+	    cold.size() != hosts.size());
+}
+
+void stop_dns_cache()
+{
+	delete the_refresher;
+	the_refresher = nullptr;
+
+	auto&& c = the_cache();
+	std::lock_guard<std::mutex> lk(c.mu);
+
+	c.addresses.clear();
+	c.pins.clear();
+}
+
+std::shared_ptr<curl_slist> pinned_addresses(std::string const& url)
+{
+	auto&& c = the_cache();
+
+	{
+		std::lock_guard<std::mutex> lk(c.mu);
+
+		if (c.pins.empty())
+			return nullptr;
+	}
+
+	auto key = url_host(url) + ':' + url_port(url);
+	std::lock_guard<std::mutex> lk(c.mu);
+	auto it = c.pins.find(key);
+
+	return it == c.pins.end() ? nullptr : it->second;
+}
+
+}
@@ -31,19 +31,61 @@
 #include <cstdlib>
 
 #include "ca_info.h"
+#include "pool_config.h"
+#include "event_loop.h"
+#include "pooled_perform.h"
+#include "rate_limiter.h"
+#include "latency_tracker.h"
+#include "flight_limiter.h"
+#include "retry_policy.h"
+#include "warm_up.h"
+#include "dns_cache.h"
+#include "connection_stats.h"
 
 namespace httpverbs
 {
 
 char* _ca_info;
 
+// of the enclosing enable_library
+struct _library_state
+{
+	char* ca_info;
+	pool_options opts;
+};
+
+static int live_libraries;
+
+// leaked, like the other singletons
+pool_options& pool_config()
+{
+	static auto p = new pool_options;
+
+	return *p;
+}
+
+static
+void stop_library()
+{
+	stop_reaping();
+	stop_rewarming();
+	stop_dns_cache();
+	stop_event_loop();
+	release_connection_pool();
+	reset_rate_limits();
+	reset_flight_limits();
+	reset_latencies();
+	reset_retry_budget();
+	reset_connection_stats();
+}
+
 static
 #if defined(_MSC_VER)
 __declspec(noinline)
 #else
 __attribute__((noinline))
 #endif
-void init_library(char* p)
+_library_state* init_library(char* p, pool_options const& opts)
 {
 	auto r = curl_global_init(CURL_GLOBAL_DEFAULT
 #ifdef CURL_GLOBAL_ACK_EINTR
@@ -52,30 +94,86 @@ void init_library(char* p)
 	    );
 
 	if (r != CURLE_OK)
+	{
+		free(p);
 		throw std::runtime_error(curl_easy_strerror(r));
+	}
+
+	_library_state* outer = nullptr;
+
+	if (live_libraries++ != 0)
+	{
+		outer = new _library_state{ _ca_info, pool_config() };
+		stop_library();
+	}
+	else
+		free(_ca_info);
 
-	free(_ca_info);
 	_ca_info = p;
-}
+	pool_config() = opts;
+	lower_host_rates(pool_config());
 
-enable_library::enable_library()
-{
-	init_library(nullptr);
+	start_dns_cache(opts);
+
+	// comes up ready to serve
+	if (not opts.warm_urls.empty())
+		warm_up(opts.warm_urls, opts.warm_connections,
+		    opts.warm_timeout);
+
+	start_rewarming(opts);
+	start_reaping(opts);
+
+	return outer;
 }
 
-enable_library::enable_library(char const* ca_info)
+static
+char* copy_ca_info(char const* ca_info)
 {
 #if defined(WIN32)
-	init_library(_strdup(ca_info));
+	return _strdup(ca_info);
 #else
-	init_library(strdup(ca_info));
+	return strdup(ca_info);
 #endif
 }
 
+enable_library::enable_library() :
+	outer_(init_library(nullptr, pool_options()))
+{}
+
+enable_library::enable_library(char const* ca_info) :
+	outer_(init_library(copy_ca_info(ca_info), pool_options()))
+{}
+
+enable_library::enable_library(pool_options const& opts) :
+	outer_(init_library(nullptr, opts))
+{}
+
+enable_library::enable_library(char const* ca_info,
+    pool_options const& opts) :
+	outer_(init_library(copy_ca_info(ca_info), opts))
+{}
+
 enable_library::~enable_library()
 {
+	stop_library();
 	free(_ca_info);
-	_ca_info = nullptr;
+	--live_libraries;
+
+	if (outer_ != nullptr)
+	{
+		_ca_info = outer_->ca_info;
+		pool_config() = outer_->opts;
+		delete outer_;
+
+		start_dns_cache(pool_config());
+		start_rewarming(pool_config());
+		start_reaping(pool_config());
+	}
+	else
+	{
+		_ca_info = nullptr;
+		pool_config() = pool_options();
+	}
 
 	curl_global_cleanup();
 }
@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <httpverbs/engine.h>
+
+#include "socket_engine.h"
+
+namespace httpverbs
+{
+
+engine::engine() :
+	impl_(new socket_engine)
+{}
+
+// aborts the transfers still running
+engine::~engine()
+{}
+
+std::future<response> engine::start(request& req, _mini_string_ref sv)
+{
+	std::future<response> fut;
+	req.start_on(this, sv, request::_fulfill(fut));
+
+	return fut;
+}
+
+std::future<response> engine::start(request& req, _mini_string_ref sv,
+    request::callback_t writer)
+{
+	std::future<response> fut;
+	req.start_on(this, sv, std::move(writer), request::_fulfill(fut));
+
+	return fut;
+}
+
+std::future<response> engine::start(request& req, request::length_t n,
+    request::callback_t reader)
+{
+	std::future<response> fut;
+	req.start_on(this, n, std::move(reader), request::_fulfill(fut));
+
+	return fut;
+}
+
+std::future<response> engine::start(request& req, request::length_t n,
+    request::callback_t reader, request::callback_t writer)
+{
+	std::future<response> fut;
+	req.start_on(this, n, std::move(reader), std::move(writer),
+	    request::_fulfill(fut));
+
+	return fut;
+}
+
+size_t engine::poll(int timeout_ms)
+{
+	return impl_->poll(timeout_ms);
+}
+
+size_t engine::running() const
+{
+	return impl_->running();
+}
+
+void engine::wakeup()
+{
+	impl_->wakeup();
+}
+
+}
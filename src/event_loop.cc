@@ -0,0 +1,293 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "event_loop.h"
+#include "socket_engine.h"
+#include "pool_config.h"
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace httpverbs
+{
+
+namespace
+{
+
+struct event_loop
+{
+	explicit event_loop(int cpu) :
+		outstanding_(0),
+		stopping_(false),
+		thr_(&event_loop::run, this)
+	{
+#if defined(__linux__)
+		if (cpu >= 0)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+
+			// an offline CPU leaves the loop unpinned
+			pthread_setaffinity_np(thr_.native_handle(),
+			    sizeof(set), &set);
+		}
+#else
+		(void)cpu;
+#endif
+	}
+
+	~event_loop()
+	{
+		stopping_ = true;
+		engine_.wakeup();
+		thr_.join();
+	}
+
+	void submit(CURL* handle, transfer_order order,
+	    transfer_handler on_done)
+	{
+		++outstanding_;
+
+		engine_.submit(handle, order, [=](CURLcode r)
+		    {
+			--outstanding_;
+			on_done(r);
+		    });
+	}
+
+	void cancel(CURL* handle, unsigned long long ticket)
+	{
+		engine_.cancel(handle, ticket);
+	}
+
+	size_t outstanding() const
+	{
+		return outstanding_;
+	}
+
+private:
+	void run()
+	{
+		while (not stopping_)
+			engine_.poll(-1);
+	}
+
+	// the transfers left over are aborted by the engine's destructor
+	socket_engine engine_;
+	std::atomic<size_t> outstanding_;
+	std::atomic<bool> stopping_;
+	std::thread thr_;
+};
+
+struct event_runtime
+{
+	explicit event_runtime(pool_options const& opts) :
+		balance_(opts.loop_balance)
+	{
+		auto n = opts.event_loops ? opts.event_loops : 1;
+		auto ncpu = std::thread::hardware_concurrency();
+
+		for (unsigned i = 0; i < n; ++i)
+			loops_.push_back(std::unique_ptr<event_loop>(
+			    new event_loop(opts.pin_event_loops and ncpu ?
+			        int(i % ncpu) : -1)));
+	}
+
+	void submit(CURL* handle, std::string const& url,
+	    transfer_order order, transfer_handler on_done)
+	{
+		pick(url).submit(handle, order, std::move(on_done));
+	}
+
+	// the loop which got the transfer is not remembered
+	void cancel(CURL* handle, unsigned long long ticket)
+	{
+		for (auto&& lp : loops_)
+			lp->cancel(handle, ticket);
+	}
+
+private:
+	event_loop& pick(std::string const& url)
+	{
+		if (loops_.size() == 1)
+			return *loops_.front();
+
+		if (balance_ == pool_options::by_host)
+			return *loops_[host_hash(url) % loops_.size()];
+
+		auto p = loops_.front().get();
+
+		for (auto&& lp : loops_)
+			if (lp->outstanding() < p->outstanding())
+				p = lp.get();
+
+		return *p;
+	}
+
+	// FNV-1a over the authority part, user info and port included
+	static size_t host_hash(std::string const& url)
+	{
+		auto i = url.find("://");
+		i = i == std::string::npos ? 0 : i + 3;
+
+		size_t h = 2166136261u;
+
+		for (; i < url.size(); ++i)
+		{
+			auto c = url[i];
+
+			if (c == '/' or c == '?' or c == '#')
+				break;
+
+			h = (h ^ (unsigned char)c) * 16777619u;
+		}
+
+		return h;
+	}
+
+	pool_options::balance balance_;
+	std::vector<std::unique_ptr<event_loop>> loops_;
+};
+
+// Leaked on purpose; the loops must be stopped by enable_library
+// before curl_global_cleanup, not by a static destructor.  A submission
+// may block for room in the queue, so it holds on to the runtime
+// rather than to the lock.
+struct loop_state
+{
+	std::mutex mu;
+	std::shared_ptr<event_runtime> runtime;
+};
+
+loop_state& the_loops()
+{
+	static auto p = new loop_state;
+
+	return *p;
+}
+
+}
+
+void submit_transfer(CURL* handle, std::string const& url,
+    transfer_order order, transfer_handler on_done)
+{
+	auto&& ls = the_loops();
+	std::shared_ptr<event_runtime> p;
+
+	{
+		std::lock_guard<std::mutex> lk(ls.mu);
+
+		if (ls.runtime == nullptr)
+			ls.runtime = std::make_shared<event_runtime>(
+			    pool_config());
+
+		p = ls.runtime;
+	}
+
+	p->submit(handle, url, order, std::move(on_done));
+}
+
+void cancel_transfer(CURL* handle, unsigned long long ticket)
+{
+	auto&& ls = the_loops();
+	std::shared_ptr<event_runtime> p;
+
+	{
+		std::lock_guard<std::mutex> lk(ls.mu);
+		p = ls.runtime;
+	}
+
+	// stopping aborts everything anyway
+	if (p != nullptr)
+		p->cancel(handle, ticket);
+}
+
+// a submission still waiting for room keeps the loops until it is in,
+// to be aborted with the rest
+void stop_event_loop()
+{
+	auto&& ls = the_loops();
+	std::shared_ptr<event_runtime> p;
+
+	{
+		std::lock_guard<std::mutex> lk(ls.mu);
+		p.swap(ls.runtime);
+	}
+}
+
+static
+long ms_until(transfer_order::clock_type::time_point t)
+{
+	using namespace std::chrono;
+
+	if (t == transfer_order::clock_type::time_point::max())
+		return 0;
+
+	// zero would mean no limit
+	auto ms = duration_cast<milliseconds>(t -
+	    transfer_order::clock_type::now()).count();
+
+	return ms < 1 ? 1 : long(ms);
+}
+
+void limit_transfer_time(CURL* handle,
+    transfer_order::clock_type::time_point deadline,
+    std::chrono::milliseconds first_byte)
+{
+	auto ms = ms_until(deadline);
+
+	if (first_byte.count() != 0 and (ms == 0 or first_byte.count() < ms))
+		ms = long(first_byte.count());
+
+	curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, ms);
+}
+
+// libcurl's timeout counts from the start of the transfer
+void lift_first_byte_limit(CURL* handle,
+    transfer_order::clock_type::time_point deadline)
+{
+	auto ms = ms_until(deadline);
+
+	if (ms != 0)
+	{
+		double s = 0;
+		curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &s);
+		ms += long(s * 1000);
+	}
+
+	curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, ms);
+}
+
+}
@@ -0,0 +1,91 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_EVENT__LOOP_H
+#define _HTTPVERBS_EVENT__LOOP_H
+
+#include <curl/curl.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <chrono>
+
+namespace httpverbs
+{
+
+struct _cancellation_state;
+
+typedef std::function<void(CURLcode)> transfer_handler;
+
+// where a transfer stands in line while an event loop is full
+struct transfer_order
+{
+	typedef std::chrono::steady_clock clock_type;
+
+	transfer_order() :
+		priority(0),
+		deadline(clock_type::time_point::max()),
+		first_byte(0),
+		ticket(0)
+	{}
+
+	int priority;
+	clock_type::time_point deadline;
+	std::chrono::milliseconds first_byte;	// zero for no limit
+	clock_type::time_point not_before;	// set by the rate limits
+	std::string host;		// set under per-host limits
+	unsigned long long ticket;	// to cancel the transfer by
+
+	// to give up waiting for room in the queue by
+	std::shared_ptr<_cancellation_state> cancel;
+};
+
+// Bounds the whole transfer, redirects included, by what is left
+// until `deadline`, and less until the first byte if `first_byte` is
+// not zero.
+void limit_transfer_time(CURL* handle,
+    transfer_order::clock_type::time_point deadline,
+    std::chrono::milliseconds first_byte);
+
+// called on the first byte, from libcurl's callback
+void lift_first_byte_limit(CURL* handle,
+    transfer_order::clock_type::time_point deadline);
+
+// hands `handle` over to one of the background event loops, starting
+// the loops on first use; `on_done` runs on the loop thread.  `url`
+// picks the loop when the loops are balanced by host.
+void submit_transfer(CURL* handle, std::string const& url,
+    transfer_order order, transfer_handler on_done);
+
+// aborts the transfer submitted with `ticket`, wherever it runs
+void cancel_transfer(CURL* handle, unsigned long long ticket);
+
+// aborts all the in-flight transfers and joins the loop threads
+void stop_event_loop();
+
+}
+
+#endif
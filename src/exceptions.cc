@@ -40,6 +40,11 @@ char const* bad_connection_pool::what() const NOEXCEPT
 	return "connection pool initialization failed";
 }
 
+char const* would_block::what() const NOEXCEPT
+{
+	return "too many transfers in flight";
+}
+
 template <>
 bad_response::bad_response(CURLcode ec) :
 	std::runtime_error(curl_easy_strerror(ec))
@@ -0,0 +1,437 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <httpverbs/stats.h>
+#include <httpverbs/exceptions.h>
+
+#include "flight_limiter.h"
+#include "socket_engine.h"
+#include "pool_config.h"
+#include "cancellation.h"
+#include "stdex/defer.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+namespace httpverbs
+{
+
+using namespace std::chrono;
+
+namespace
+{
+
+// the adaptive limits start small and never close
+double const initial_window = 4;
+double const min_window = 1;
+double const max_window = 1000;
+
+// latency past this many times the baseline means the host queues
+double const queueing_ratio = 2;
+
+struct host_window
+{
+	host_window() :
+		limit(initial_window),
+		min_rtt(0),
+		srtt(0)
+	{}
+
+	double limit;
+	double min_rtt;		// seconds to the first byte, unloaded
+	double srtt;
+	steady_clock::time_point last_cut;
+};
+
+struct flight_limiter
+{
+	flight_limiter() :
+		outstanding(0),
+		in_flight(0),
+		started(0),
+		total_wait_ns(0),
+		max_wait_ns(0),
+		has_waiters(false)
+	{}
+
+	std::atomic<long> outstanding;	// entered, not yet left or ended
+	std::atomic<long> in_flight;
+	std::atomic<unsigned long long> started;
+	std::atomic<long long> total_wait_ns;
+	std::atomic<long long> max_wait_ns;
+
+	std::mutex mu;
+	std::condition_variable room;
+	std::unordered_map<std::string, long> hosts;
+	std::unordered_map<std::string, host_window> windows;
+	std::vector<socket_engine*> engines;
+	std::vector<socket_engine*> waiters;
+	std::atomic<bool> has_waiters;
+};
+
+// leaked on purpose, like the event loops' mutex
+flight_limiter& the_limiter()
+{
+	static auto p = new flight_limiter;
+
+	return *p;
+}
+
+long capacity()
+{
+	auto&& opts = pool_config();
+
+	if (opts.max_in_flight <= 0 or opts.max_queued < 0)
+		return -1;
+
+	return opts.max_in_flight + opts.max_queued;
+}
+
+// the caller holds the lock
+long host_limit(flight_limiter& lm, std::string const& host)
+{
+	if (not pool_config().adaptive_host_in_flight)
+		return pool_config().max_host_in_flight;
+
+	auto it = lm.windows.find(host);
+
+	return long(it == lm.windows.end() ? initial_window :
+	    it->second.limit);
+}
+
+bool take(std::atomic<long>& n, long cap)
+{
+	auto v = n.load();
+
+	while (cap < 0 or v < cap)
+		if (n.compare_exchange_weak(v, v + 1))
+			return true;
+
+	return false;
+}
+
+void make_room(flight_limiter& lm)
+{
+	--lm.outstanding;
+
+	if (capacity() >= 0 and
+	    pool_config().when_full == pool_options::wait_for_room)
+	{
+		// pairs with the check under the lock in enter_queue
+		{
+			std::lock_guard<std::mutex> lk(lm.mu);
+		}
+
+		lm.room.notify_one();
+	}
+}
+
+}
+
+void enter_queue(_cancellation_state* cs)
+{
+	auto&& lm = the_limiter();
+	auto cap = capacity();
+
+	if (take(lm.outstanding, cap))
+		return;
+
+	if (pool_config().when_full == pool_options::fail_at_once)
+		throw would_block();
+
+	auto me = std::this_thread::get_id();
+
+	{
+		std::lock_guard<std::mutex> lk(lm.mu);
+
+		if (std::any_of(lm.engines.begin(), lm.engines.end(),
+		    [&](socket_engine* e)
+		    {
+			return e->poller() == me;
+		    }))
+		{
+			++lm.outstanding;
+			return;
+		}
+	}
+
+	// a cancellation stops the wait
+	bool cancelled = false;
+	unsigned long long cid = 0;
+
+	if (cs != nullptr)
+	{
+		cid = on_cancel(*cs, [&]
+		    {
+			std::lock_guard<std::mutex> lk(lm.mu);
+			cancelled = true;
+			lm.room.notify_all();
+		    });
+
+		if (cid == 0)
+			throw bad_response(CURLE_ABORTED_BY_CALLBACK);
+	}
+
+	defer(if (cid != 0) forget_cancel(*cs, cid));
+
+	{
+		std::unique_lock<std::mutex> lk(lm.mu);
+		lm.room.wait(lk, [&]
+		    {
+			return cancelled or take(lm.outstanding, cap);
+		    });
+
+		if (not cancelled)
+			return;
+	}
+
+	// the wakeup may have been meant for another
+	lm.room.notify_one();
+	throw bad_response(CURLE_ABORTED_BY_CALLBACK);
+}
+
+void leave_queue()
+{
+	make_room(the_limiter());
+}
+
+bool try_start_flight(std::string const& host,
+    steady_clock::time_point submitted, socket_engine* e)
+{
+	auto&& lm = the_limiter();
+	auto&& opts = pool_config();
+
+	auto try_start = [&]() -> bool
+	    {
+		if (limits_hosts())
+		{
+			std::lock_guard<std::mutex> lk(lm.mu);
+			auto&& n = lm.hosts[host];
+
+			if (n >= host_limit(lm, host) or
+			    not take(lm.in_flight, opts.max_in_flight > 0 ?
+			    opts.max_in_flight : -1))
+				return false;
+
+			++n;
+			return true;
+		}
+
+		return take(lm.in_flight, opts.max_in_flight > 0 ?
+		    opts.max_in_flight : -1);
+	    };
+
+	if (not try_start())
+	{
+		{
+			std::lock_guard<std::mutex> lk(lm.mu);
+
+			if (std::find(lm.waiters.begin(), lm.waiters.end(),
+			    e) == lm.waiters.end())
+				lm.waiters.push_back(e);
+
+			lm.has_waiters = true;
+		}
+
+		// a flight may have ended before we were listed
+		if (not try_start())
+			return false;
+	}
+
+	auto ns = duration_cast<nanoseconds>(steady_clock::now() -
+	    submitted).count();
+	auto mx = lm.max_wait_ns.load();
+
+	++lm.started;
+	lm.total_wait_ns += ns;
+
+	while (ns > mx and not lm.max_wait_ns.compare_exchange_weak(mx, ns))
+		;
+
+	return true;
+}
+
+void end_flight(std::string const& host)
+{
+	auto&& lm = the_limiter();
+
+	if (limits_hosts())
+	{
+		std::lock_guard<std::mutex> lk(lm.mu);
+		auto it = lm.hosts.find(host);
+
+		if (it != lm.hosts.end() and --it->second == 0)
+			lm.hosts.erase(it);
+	}
+
+	--lm.in_flight;
+	make_room(lm);
+
+	if (lm.has_waiters)
+	{
+		// under the lock, or the engines may be gone
+		std::lock_guard<std::mutex> lk(lm.mu);
+
+		for (auto e : lm.waiters)
+			e->wakeup();
+
+		lm.waiters.clear();
+		lm.has_waiters = false;
+	}
+}
+
+bool limits_hosts()
+{
+	return pool_config().max_host_in_flight > 0 or
+	    pool_config().adaptive_host_in_flight;
+}
+
+// Additive increase while the window is in use and the latency holds
+// near its baseline; multiplicative decrease, at most once a round
+// trip, on errors and overload statuses or as the latency climbs.
+void observe_flight(std::string const& host, CURL* handle, CURLcode r)
+{
+	// a cancellation says nothing about the host
+	if (not pool_config().adaptive_host_in_flight or
+	    r == CURLE_ABORTED_BY_CALLBACK)
+		return;
+
+	long status = 0;
+	double ttfb = 0;
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+
+	bool overloaded = r != CURLE_OK or status == 429 or
+	    status == 502 or status == 503 or status == 504;
+	auto now = steady_clock::now();
+
+	auto&& lm = the_limiter();
+	std::lock_guard<std::mutex> lk(lm.mu);
+	auto&& w = lm.windows[host];
+
+	auto cut = [&](double factor)
+	    {
+		if (now - w.last_cut < duration<double>(w.srtt))
+			return;
+
+		w.limit *= factor;
+		w.last_cut = now;
+	    };
+
+	if (overloaded)
+		cut(0.5);
+	else
+	{
+		if (w.srtt == 0)
+			w.srtt = w.min_rtt = ttfb;
+
+		w.srtt += (ttfb - w.srtt) / 8;
+
+		// drifts up, or a host slower for good stays throttled
+		if (ttfb < w.min_rtt)
+			w.min_rtt = ttfb;
+		else
+			w.min_rtt += (w.srtt - w.min_rtt) / 256;
+
+		auto it = lm.hosts.find(host);
+		bool busy = it != lm.hosts.end() and
+		    it->second >= long(w.limit);
+
+		if (w.srtt > queueing_ratio * w.min_rtt)
+			cut(0.9);
+		else if (busy)
+			w.limit += 1 / w.limit;
+	}
+
+	auto cap = pool_config().max_host_in_flight > 0 ?
+	    double(pool_config().max_host_in_flight) : max_window;
+
+	w.limit = std::min(std::max(w.limit, min_window), cap);
+}
+
+void register_engine(socket_engine* e)
+{
+	auto&& lm = the_limiter();
+	std::lock_guard<std::mutex> lk(lm.mu);
+
+	lm.engines.push_back(e);
+}
+
+void unregister_engine(socket_engine* e)
+{
+	auto&& lm = the_limiter();
+	std::lock_guard<std::mutex> lk(lm.mu);
+
+	lm.engines.erase(std::remove(lm.engines.begin(), lm.engines.end(), e),
+	    lm.engines.end());
+	lm.waiters.erase(std::remove(lm.waiters.begin(), lm.waiters.end(), e),
+	    lm.waiters.end());
+}
+
+void reset_flight_limits()
+{
+	auto&& lm = the_limiter();
+
+	{
+		std::lock_guard<std::mutex> lk(lm.mu);
+		lm.windows.clear();
+	}
+
+	lm.started = 0;
+	lm.total_wait_ns = 0;
+	lm.max_wait_ns = 0;
+}
+
+queue_stats transfer_queue_stats()
+{
+	auto&& lm = the_limiter();
+	long in_flight = lm.in_flight;
+	long outstanding = lm.outstanding;
+
+	queue_stats st = {
+		size_t(in_flight),
+		size_t(outstanding > in_flight ? outstanding - in_flight : 0),
+		lm.started,
+		nanoseconds(lm.total_wait_ns),
+		nanoseconds(lm.max_wait_ns),
+	};
+
+	return st;
+}
+
+long host_in_flight_limit(std::string const& host)
+{
+	auto&& lm = the_limiter();
+	std::lock_guard<std::mutex> lk(lm.mu);
+
+	return host_limit(lm, host);
+}
+
+}
@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_FLIGHT__LIMITER_H
+#define _HTTPVERBS_FLIGHT__LIMITER_H
+
+#include <curl/curl.h>
+
+#include <string>
+#include <chrono>
+
+namespace httpverbs
+{
+
+struct socket_engine;
+struct _cancellation_state;
+
+// The process-wide limits on the asynchronous transfers, shared by
+// all the socket engines: how many may run, in total and per host, and
+// how many more may wait to be admitted.
+
+// Counts a submission in.  Past pool_options::max_in_flight plus
+// max_queued, blocks or throws would_block by pool_options::when_full;
+// a thread polling an engine never blocks, or it might wait for
+// itself.  Throws bad_response if `cs`, when not null, is cancelled
+// before there is room.
+void enter_queue(_cancellation_state* cs);
+
+// a submission leaves without having started
+void leave_queue();
+
+// Starts a flight to `host` (empty when there is no per-host limit),
+// which has been waiting since `submitted`.  On failure, `e` is woken
+// up when a flight ends.
+bool try_start_flight(std::string const& host,
+    std::chrono::steady_clock::time_point submitted, socket_engine* e);
+void end_flight(std::string const& host);
+
+// whether the transfers to each host are counted
+bool limits_hosts();
+
+// Feeds a finished transfer of `handle`, failed or not, to the
+// adaptive limit of `host`.
+void observe_flight(std::string const& host, CURL* handle, CURLcode r);
+
+void register_engine(socket_engine* e);
+void unregister_engine(socket_engine* e);
+
+// forgets the statistics along with the options
+void reset_flight_limits();
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "latency_tracker.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+namespace httpverbs
+{
+
+namespace
+{
+
+// a window of the latest samples, so that the quantiles follow the
+// host as its load changes
+size_t const window_size = 128;
+size_t const min_samples = 20;
+
+struct host_samples
+{
+	host_samples() :
+		next(0),
+		hedges(1)
+	{}
+
+	std::vector<double> ls;
+	size_t next;
+	double hedges;		// at most one saved up
+};
+
+struct latency_tracker
+{
+	std::mutex mu;
+	std::unordered_map<std::string, host_samples> hosts;
+};
+
+// leaked on purpose, like the rate limiter
+latency_tracker& the_tracker()
+{
+	static auto p = new latency_tracker;
+
+	return *p;
+}
+
+}
+
+void record_latency(std::string const& host, double seconds)
+{
+	auto&& tr = the_tracker();
+	std::lock_guard<std::mutex> lk(tr.mu);
+	auto&& h = tr.hosts[host];
+
+	if (h.ls.size() < window_size)
+		h.ls.push_back(seconds);
+	else
+		h.ls[h.next] = seconds;
+
+	h.next = (h.next + 1) % window_size;
+}
+
+bool plan_hedge(std::string const& host, double budget, double q,
+    std::chrono::microseconds& d)
+{
+	std::vector<double> ls;
+
+	{
+		auto&& tr = the_tracker();
+		std::lock_guard<std::mutex> lk(tr.mu);
+		auto&& h = tr.hosts[host];
+
+		h.hedges = std::min(h.hedges + budget, 1.0);
+
+		if (h.hedges < 1)
+			return false;
+
+		if (d.count() == 0)
+		{
+			if (h.ls.size() < min_samples)
+				return false;
+
+			ls = h.ls;
+		}
+
+		h.hedges -= 1;
+	}
+
+	if (not ls.empty())
+	{
+		auto nth = ls.begin() + ptrdiff_t(q * double(ls.size() - 1));
+		std::nth_element(ls.begin(), nth, ls.end());
+		d = std::chrono::microseconds((long long)(*nth * 1e6));
+	}
+
+	return true;
+}
+
+void reset_latencies()
+{
+	auto&& tr = the_tracker();
+	std::lock_guard<std::mutex> lk(tr.mu);
+
+	tr.hosts.clear();
+}
+
+}
@@ -26,6 +26,8 @@
 #include <httpverbs/exceptions.h>
 
 #include "pooled_perform.h"
+#include "pool_config.h"
+#include "connection_stats.h"
 #include "config.h"
 
 #if defined(USE_BOOST_CHRONO)
@@ -46,6 +48,12 @@
 #endif
 
 #include <memory>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include "stdex/defer.h"
 
 #if !defined(USE_BOOST_TSS)
@@ -80,83 +88,555 @@
 namespace httpverbs
 {
 
-static CURLcode do_transfer(CURLM*);
+static void perform_in(CURLM*, CURL**, size_t, CURLcode*,
+    perform_interrupt*);
+static void do_transfer(CURLM*, CURL**, size_t, CURLcode*,
+    perform_interrupt*);
 
-#if defined(PER_THREAD_CACHE) && defined(USE_BOOST_TSS)
+namespace
+{
 
-static
-void curl_share_cleanup(char* p)
+// The share handle is used by all the threads, so it is locked with
+// one mutex per kind of shared data; a DNS lookup does not wait for a
+// TLS session lookup, and vice versa.
+struct locked_share
+{
+	locked_share();
+	~locked_share();
+
+	CURLSH* get() const
+	{
+		return handle_;
+	}
+
+private:
+	static void lock(CURL*, curl_lock_data data, curl_lock_access,
+	    void* p)
+	{
+		static_cast<locked_share*>(p)->locks_[data].lock();
+	}
+
+	static void unlock(CURL*, curl_lock_data data, void* p)
+	{
+		static_cast<locked_share*>(p)->locks_[data].unlock();
+	}
+
+	locked_share(locked_share const&);  // = delete
+	locked_share& operator=(locked_share const&);  // = delete
+
+	CURLSH* handle_;
+	std::mutex locks_[CURL_LOCK_DATA_LAST];
+};
+
+locked_share::locked_share() :
+	handle_(curl_share_init())
 {
-	::curl_share_cleanup((CURLSH*)p);
+	if (handle_ == nullptr)
+		throw bad_connection_pool();
+
+	if (curl_share_setopt(handle_, CURLSHOPT_LOCKFUNC, lock) or
+	    curl_share_setopt(handle_, CURLSHOPT_UNLOCKFUNC, unlock) or
+	    curl_share_setopt(handle_, CURLSHOPT_USERDATA, this) or
+	    curl_share_setopt(handle_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) or
+	    curl_share_setopt(handle_, CURLSHOPT_SHARE,
+	    CURL_LOCK_DATA_SSL_SESSION))
+	{
+		curl_share_cleanup(handle_);
+		throw bad_connection_pool();
+	}
 }
 
-static
-void curl_multi_cleanup(char* p)
+locked_share::~locked_share()
 {
-	::curl_multi_cleanup((CURLM*)p);
+	curl_share_cleanup(handle_);
+}
+
 }
 
+CURLM* new_multi_handle(connection_stats::pool_kind kind)
+{
+	auto p = curl_multi_init();
+
+	if (p == nullptr)
+		throw bad_connection_pool();
+
+	auto&& opts = pool_config();
+
+	if (curl_multi_setopt(p, CURLMOPT_MAXCONNECTS, opts.max_connections)
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	    or curl_multi_setopt(p, CURLMOPT_MAX_HOST_CONNECTIONS,
+	    opts.max_host_connections)
+	    or curl_multi_setopt(p, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+	    opts.max_total_connections)
 #endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	    or curl_multi_setopt(p, CURLMOPT_PIPELINING,
+	    opts.multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING)
+#endif
+	    )
+	{
+		curl_multi_cleanup(p);
+		throw bad_connection_pool();
+	}
+
+	add_pool(p, kind);
+
+	return p;
+}
+
+void free_multi_handle(CURLM* multi)
+{
+	curl_multi_cleanup(multi);
+	forget_pool(multi);
+}
+
+// Name resolutions and TLS sessions are shared by the whole process,
+// so that a new thread does not start with a cold cache.
+static std::atomic<locked_share*> process_share;
+static std::mutex process_share_mutex;
 
-static
 CURLSH* share_handle()
 {
-	TSS_POINTER(CURLSH, handle, curl_share_cleanup, []() -> CURLSH*
-	    {
-		auto p = curl_share_init();
+	auto p = process_share.load(std::memory_order_acquire);
+
+	if (p == nullptr)
+	{
+		std::lock_guard<std::mutex> lk(process_share_mutex);
+		p = process_share.load(std::memory_order_relaxed);
 
 		if (p == nullptr)
-			throw bad_connection_pool();
+		{
+			p = new locked_share;
+			process_share.store(p, std::memory_order_release);
+		}
+	}
 
-		if (curl_share_setopt(p, CURLSHOPT_SHARE,
-		    CURL_LOCK_DATA_SSL_SESSION))
-			throw bad_connection_pool();
+	return p->get();
+}
 
-		return p;
-	    }());
+#if defined(SHARED_CACHE)
+
+// libcurl does not support a connection cache shared by the multi
+// handles of several threads, so with SHARED_CACHE the threads share
+// the multi handles instead.  A thread takes the one returned last,
+// which holds the connections most likely to be alive, and has it to
+// itself until its transfers are done.
+struct shared_multi_list
+{
+	std::mutex mu;
+	std::vector<CURLM*> idle;
+};
+
+static shared_multi_list& shared_multis()
+{
+	static auto p = new shared_multi_list;
 
-	return handle.get();
+	return *p;
 }
 
-static
-CURLM* multi_handle()
+static CURLM* take_shared_multi()
+{
+	auto&& ls = shared_multis();
+
+	{
+		std::lock_guard<std::mutex> lk(ls.mu);
+
+		if (not ls.idle.empty())
+		{
+			auto p = ls.idle.back();
+			ls.idle.pop_back();
+
+			return p;
+		}
+	}
+
+	return new_multi_handle(connection_stats::shared);
+}
+
+static void return_shared_multi(CURLM* multi)
+{
+	auto&& ls = shared_multis();
+	std::lock_guard<std::mutex> lk(ls.mu);
+	ls.idle.push_back(multi);
+}
+
+#endif
+
+void release_connection_pool()
+{
+#if defined(SHARED_CACHE)
+	{
+		auto&& ls = shared_multis();
+		std::lock_guard<std::mutex> lk(ls.mu);
+
+		for (auto p : ls.idle)
+			free_multi_handle(p);
+
+		ls.idle.clear();
+	}
+#endif
+
+	delete process_share.exchange(nullptr);
+}
+
+#if defined(PER_THREAD_CACHE) && !defined(SHARED_CACHE)
+#define REAPED_POOLS
+#endif
+
+namespace
+{
+
+// A blocking thread's pool.  The thread holds `mu` through its
+// transfers, so the reaper empties only the pools not in use, by
+// cleaning their multi handles up; the thread makes another one on
+// its next transfer.
+struct thread_pool
+{
+	thread_pool() :
+		multi(nullptr)
+	{}
+
+	std::mutex mu;
+	CURLM* multi;
+	std::chrono::steady_clock::time_point last_used;
+};
+
+// leaked, so that the threads exiting late can still unregister
+struct thread_pool_list
+{
+	std::mutex mu;
+	std::vector<thread_pool*> pools;
+};
+
+thread_pool_list& thread_pools()
+{
+	static auto p = new thread_pool_list;
+
+	return *p;
+}
+
+#if !defined(SHARED_CACHE)
+
+thread_pool* new_thread_pool()
+{
+	auto p = new thread_pool;
+
+#if defined(REAPED_POOLS)
+	auto&& ls = thread_pools();
+	std::lock_guard<std::mutex> lk(ls.mu);
+	ls.pools.push_back(p);
+#endif
+
+	return p;
+}
+
+void drop_thread_pool(thread_pool* p)
+{
+#if defined(REAPED_POOLS)
+	{
+		auto&& ls = thread_pools();
+		std::lock_guard<std::mutex> lk(ls.mu);
+		ls.pools.erase(std::find(ls.pools.begin(), ls.pools.end(),
+		    p));
+	}
+#endif
+
+	if (p->multi != nullptr)
+		free_multi_handle(p->multi);
+
+	delete p;
+}
+
+#if defined(USE_BOOST_TSS)
+
+void drop_thread_pool(char* p)
+{
+	drop_thread_pool(reinterpret_cast<thread_pool*>(p));
+}
+
+#endif
+
+thread_pool& this_thread_pool()
 {
-	TSS_POINTER(CURLM, handle, curl_multi_cleanup, []() -> CURLM*
+	TSS_POINTER(thread_pool, pool, drop_thread_pool, new_thread_pool());
+
+	return *reinterpret_cast<thread_pool*>(pool.get());
+}
+
+#endif
+
+void empty_pool(thread_pool& pool)
+{
+	free_multi_handle(pool.multi);
+	pool.multi = nullptr;
+}
+
+// Empties the pools not in use and untouched for `max_idle`, then the
+// least recently used ones, until the others hold at most `max_idle`
+// idle connections.  libcurl can not close a connection of its
+// choosing, so a pool goes as a whole.
+void reap_pools(std::chrono::seconds max_idle,
+    size_t max_idle_connections)
+{
+	auto now = std::chrono::steady_clock::now();
+	auto&& ls = thread_pools();
+	std::lock_guard<std::mutex> lk(ls.mu);
+
+	struct idle_pool
+	{
+		thread_pool* p;
+		size_t n;
+	};
+
+	std::vector<std::unique_lock<std::mutex>> held;
+	std::vector<idle_pool> idle;
+	size_t total = 0;
+
+	for (auto p : ls.pools)
+	{
+		std::unique_lock<std::mutex> plk(p->mu, std::try_to_lock);
+
+		if (not plk.owns_lock() or p->multi == nullptr)
+			continue;
+
+		if (max_idle.count() != 0 and now - p->last_used >= max_idle)
+		{
+			empty_pool(*p);
+			continue;
+		}
+
+		idle_pool ip = { p, idle_connections(p->multi) };
+		total += ip.n;
+		idle.push_back(ip);
+		held.push_back(std::move(plk));
+	}
+
+	if (max_idle_connections == 0 or total <= max_idle_connections)
+		return;
+
+	std::sort(idle.begin(), idle.end(),
+	    [](idle_pool const& a, idle_pool const& b)
 	    {
-		auto p = curl_multi_init();
+		return a.p->last_used < b.p->last_used;
+	    });
 
-		if (p == nullptr)
-			throw bad_connection_pool();
+	for (auto&& ip : idle)
+	{
+		if (total <= max_idle_connections)
+			break;
 
-		// libcurl hard-coded ssl session cache to 8, so it
-		// doesn't help much to cache more connections
-		if (curl_multi_setopt(p, CURLMOPT_MAXCONNECTS, 8L))
-			throw bad_connection_pool();
+		if (ip.n == 0)
+			continue;
+
+		empty_pool(*ip.p);
+		total -= ip.n;
+	}
+}
+
+struct reaper
+{
+	explicit reaper(pool_options const& opts) :
+		max_idle_(opts.max_idle_time),
+		max_idle_connections_(size_t(opts.max_idle_connections)),
+		stopping_(false),
+		thr_(&reaper::run, this)
+	{}
+
+	~reaper()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu_);
+			stopping_ = true;
+		}
+
+		cv_.notify_one();
+		thr_.join();
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+
+		while (not cv_.wait_for(lk, std::chrono::seconds(1), [&]
+		    {
+			return stopping_;
+		    }))
+		{
+			lk.unlock();
+			reap_pools(max_idle_, max_idle_connections_);
+			lk.lock();
+		}
+	}
+
+	std::chrono::seconds max_idle_;
+	size_t max_idle_connections_;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	bool stopping_;
+	std::thread thr_;
+};
+
+reaper* the_reaper;
+
+}
+
+void start_reaping(pool_options const& opts)
+{
+#if defined(REAPED_POOLS)
+	if (opts.max_idle_time.count() == 0 and
+	    opts.max_idle_connections <= 0)
+		return;
+
+	delete the_reaper;
+	the_reaper = new reaper(opts);
+#else
+	(void)opts;
+#endif
+}
+
+void stop_reaping()
+{
+	delete the_reaper;
+	the_reaper = nullptr;
+}
+
+void bound_connection_age(CURL* handle, pool_options const& opts)
+{
+#if LIBCURL_VERSION_NUM >= 0x074100
+	if (opts.max_idle_time.count() != 0)
+		curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN,
+		    long(opts.max_idle_time.count()));
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+	if (opts.max_connection_age.count() != 0)
+		curl_easy_setopt(handle, CURLOPT_MAXLIFETIME_CONN,
+		    long(opts.max_connection_age.count()));
+#endif
+
+	(void)handle;
+	(void)opts;
+}
 
-		return p;
-	    }());
+void perform_interrupt::trigger()
+{
+	requested = true;
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+	std::lock_guard<std::mutex> lk(mu);
+
+	if (multi != nullptr)
+		curl_multi_wakeup(multi);
+#endif
+}
+
+CURLcode pooled_perform(CURL* handle, perform_interrupt* intr)
+{
+	CURLcode r;
+	pooled_perform_all(&handle, 1, &r, intr);
 
-	return handle.get();
+	return r;
 }
 
-CURLcode pooled_perform(CURL* handle)
+void with_thread_pool(std::function<void(CURLM*)> const& fn)
+{
+#if defined(SHARED_CACHE)
+	auto conn_cache = take_shared_multi();
+
+	defer(return_shared_multi(conn_cache));
+#else
+	auto&& pool = this_thread_pool();
+
+#if defined(REAPED_POOLS)
+	std::lock_guard<std::mutex> lk(pool.mu);
+#endif
+
+	if (pool.multi == nullptr)
+	{
+#if defined(PER_THREAD_CACHE)
+		pool.multi = new_multi_handle(connection_stats::per_thread);
+#else
+		pool.multi = new_multi_handle(connection_stats::shared);
+#endif
+	}
+
+	auto conn_cache = pool.multi;
+
+	defer(pool.last_used = std::chrono::steady_clock::now());
+#endif
+
+	fn(conn_cache);
+}
+
+void pooled_perform_all(CURL** handles, size_t n, CURLcode* results,
+    perform_interrupt* intr)
 {
 	// libcurl tries to handle SIGPIPE internally no matter whether
 	// CURLOPT_NOSIGNAL is set.  Hope it's not a big deal if we
 	// unconditionally do not block SIGPIPE here.
 
+	with_thread_pool([&](CURLM* conn_cache)
+	    {
+		perform_in(conn_cache, handles, n, results, intr);
+	    });
+}
+
+static
+void perform_in(CURLM* conn_cache, CURL** handles, size_t n,
+    CURLcode* results, perform_interrupt* intr)
+{
 	auto ssl_cache = share_handle();
-	auto conn_cache = multi_handle();
+	size_t added = 0;
 
-	curl_easy_setopt(handle, CURLOPT_SHARE, ssl_cache);
-	defer(curl_easy_setopt(handle, CURLOPT_SHARE, nullptr));
+	// removing the handles leaves their connections in the pool; only
+	// curl_multi_cleanup closes them
+	defer(
+	    for (size_t i = 0; i < added; ++i)
+	    {
+		curl_multi_remove_handle(conn_cache, handles[i]);
+		curl_easy_setopt(handles[i], CURLOPT_SHARE, nullptr);
+		end_pool_transfer(handles[i]);
+	    });
 
-	if (curl_multi_add_handle(conn_cache, handle))
-		throw bad_connection_pool();
+	for (; added < n; ++added)
+	{
+		curl_easy_setopt(handles[added], CURLOPT_SHARE, ssl_cache);
+		start_pool_transfer(conn_cache, handles[added]);
+
+		if (curl_multi_add_handle(conn_cache, handles[added]))
+		{
+			curl_easy_setopt(handles[added], CURLOPT_SHARE,
+			    nullptr);
+			end_pool_transfer(handles[added]);
+			throw bad_connection_pool();
+		}
+	}
+
+	auto attach = [&](CURLM* multi)
+	    {
+		if (intr != nullptr)
+		{
+			std::lock_guard<std::mutex> ilk(intr->mu);
+			intr->multi = multi;
+		}
+	    };
 
-	defer(curl_multi_remove_handle(conn_cache, handle));
+	attach(conn_cache);
+	defer(attach(nullptr));
 
-	return do_transfer(conn_cache);
+	do_transfer(conn_cache, handles, n, results, intr);
+}
+
+static
+bool interrupted(perform_interrupt* intr, size_t n, CURLcode* rs)
+{
+	if (intr == nullptr or not intr->requested)
+		return false;
+
+	std::fill_n(rs, n, CURLE_ABORTED_BY_CALLBACK);
+
+	return true;
 }
 
 #if defined(USE_BOOST_CHRONO)
@@ -165,6 +645,61 @@ using namespace boost::chrono;
 using namespace std::chrono;
 #endif
 
+static
+void collect_results(CURLM* multi, CURL** handles, size_t n, CURLcode* rs)
+{
+	int rc;
+
+	while (auto msg = curl_multi_info_read(multi, &rc))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		auto it = std::find(handles, handles + n, msg->easy_handle);
+
+		if (it != handles + n)
+			rs[it - handles] = msg->data.result;
+	}
+}
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+
+// Unlike curl_multi_wait, curl_multi_poll sleeps until libcurl's own
+// timeout even if there is no socket to wait on (e.g. during name
+// resolution), so the loop never needs to guess how long to back off.
+void do_transfer(CURLM* multi, CURL** handles, size_t n, CURLcode* rs,
+    perform_interrupt* intr)
+{
+	int still_running;
+
+	std::fill_n(rs, n, CURLE_OK);
+
+	while (1)
+	{
+		if (interrupted(intr, n, rs))
+			return;
+
+		if (curl_multi_perform(multi, &still_running))
+		{
+			std::fill_n(rs, n, CURLE_OUT_OF_MEMORY);
+			return;
+		}
+
+		if (not still_running)
+			break;
+
+		if (curl_multi_poll(multi, nullptr, 0, 1000, nullptr))
+		{
+			std::fill_n(rs, n, CURLE_OUT_OF_MEMORY);
+			return;
+		}
+	}
+
+	collect_results(multi, handles, n, rs);
+}
+
+#else
+
 template <typename Rep, typename Period>
 inline
 void wait_for(duration<Rep,Period> const& d)
@@ -181,23 +716,32 @@ void wait_for(duration<Rep,Period> const& d)
 }
 
 // The code is modified from libcurl's `easy_transfer` function
-// in lib/easy.c, with less states using returns.
-CURLcode do_transfer(CURLM* multi)
+// in lib/easy.c, with less states using returns.  The backoff is
+// capped by libcurl's timeout, so that it won't oversleep a
+// resolver or handshake which is about to make progress.
+void do_transfer(CURLM* multi, CURL** handles, size_t n, CURLcode* rs,
+    perform_interrupt* intr)
 {
 	int without_fds = 0;
 	int still_running;
 
+	std::fill_n(rs, n, CURLE_OK);
+
 	do
 	{
 		int ret;
 		auto before = high_resolution_clock::now();
 
 		if (curl_multi_wait(multi, nullptr, 0, 1000, &ret))
-			return CURLE_OUT_OF_MEMORY;
+		{
+			std::fill_n(rs, n, CURLE_OUT_OF_MEMORY);
+			return;
+		}
 
 		if (ret == -1)
 		{
-			return CURLE_RECV_ERROR;
+			std::fill_n(rs, n, CURLE_RECV_ERROR);
+			return;
 		}
 		else if (ret == 0)
 		{
@@ -209,11 +753,17 @@ CURLcode do_transfer(CURLM* multi)
 
 				if (without_fds > 2)
 				{
-					if (without_fds < 10)
-						wait_for(milliseconds(
-						    1 << (without_fds - 1)));
-					else
-						wait_for(seconds(1));
+					auto d = milliseconds(without_fds < 10 ?
+					    1 << (without_fds - 1) : 1000);
+					long timeout_ms;
+
+					if (curl_multi_timeout(multi,
+					    &timeout_ms) == CURLM_OK and
+					    timeout_ms >= 0 and
+					    milliseconds(timeout_ms) < d)
+						d = milliseconds(timeout_ms);
+
+					wait_for(d);
 				}
 			}
 			else
@@ -222,18 +772,20 @@ CURLcode do_transfer(CURLM* multi)
 		else
 			without_fds = 0;
 
+		if (interrupted(intr, n, rs))
+			return;
+
 		if (curl_multi_perform(multi, &still_running))
-			return CURLE_OUT_OF_MEMORY;
+		{
+			std::fill_n(rs, n, CURLE_OUT_OF_MEMORY);
+			return;
+		}
 
 	} while (still_running);
 
-	int rc;
-	auto msg = curl_multi_info_read(multi, &rc);
-
-	if (msg != nullptr)
-		return msg->data.result;
-	else
-		return CURLE_OK;
+	collect_results(multi, handles, n, rs);
 }
 
+#endif
+
 }
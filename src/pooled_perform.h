@@ -26,12 +26,59 @@
 #ifndef _HTTPVERBS_POOLED__PERFORM_H
 #define _HTTPVERBS_POOLED__PERFORM_H
 
+#include <httpverbs/stats.h>
+#include <httpverbs/pool_options.h>
+
 #include <curl/curl.h>
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+
 namespace httpverbs
 {
 
-CURLcode pooled_perform(CURL* handle);
+// Aborts a pooled_perform from another thread, waking it up if
+// libcurl can (7.68 and up); otherwise it notices within a second.
+struct perform_interrupt
+{
+	perform_interrupt() :
+		requested(false),
+		multi(nullptr)
+	{}
+
+	void trigger();
+
+	std::atomic<bool> requested;
+
+	// set by pooled_perform, and cleared before its pool may go to
+	// the reaper or another thread
+	std::mutex mu;
+	CURLM* multi;
+};
+
+CURLSH* share_handle();
+CURLM* new_multi_handle(connection_stats::pool_kind kind);
+void free_multi_handle(CURLM* multi);
+void release_connection_pool();
+
+// closes the connections past pool_options::max_idle_time and
+// max_connection_age, when `handle` looks for one to reuse
+void bound_connection_age(CURL* handle, pool_options const& opts);
+
+// empties the blocking threads' pools by pool_options::max_idle_time
+// and max_idle_connections, on a thread of its own
+void start_reaping(pool_options const& opts);
+void stop_reaping();
+
+// Lends `fn` the multi handle pooled_perform_all uses on this thread,
+// kept from the reaper and the other threads as long as `fn` runs.
+void with_thread_pool(std::function<void(CURLM*)> const& fn);
+
+// an interrupted transfer ends with CURLE_ABORTED_BY_CALLBACK
+CURLcode pooled_perform(CURL* handle, perform_interrupt* intr = nullptr);
+void pooled_perform_all(CURL** handles, size_t n, CURLcode* results,
+    perform_interrupt* intr = nullptr);
 
 }
 
@@ -0,0 +1,185 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "rate_limiter.h"
+#include "pool_config.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <map>
+#include <cctype>
+
+namespace httpverbs
+{
+
+using namespace std::chrono;
+
+typedef steady_clock clock_type;
+
+std::string url_host(std::string const& url)
+{
+	auto i = url.find("://");
+	i = i == std::string::npos ? 0 : i + 3;
+
+	auto j = url.find_first_of("/?#", i);
+
+	if (j == std::string::npos)
+		j = url.size();
+
+	auto at = url.rfind('@', j);
+
+	if (at != std::string::npos and at >= i)
+		i = at + 1;
+
+	// an IPv6 literal has colons of its own
+	auto k = url[i] == '[' ? url.find(']', i) : i;
+
+	if (k == std::string::npos or k > j)
+		k = i;
+
+	auto colon = url.find(':', k);
+
+	if (colon != std::string::npos and colon < j)
+		j = colon;
+
+	std::string host(url, i, j - i);
+
+	for (auto&& c : host)
+		c = char(std::tolower((unsigned char)c));
+
+	return host;
+}
+
+namespace
+{
+
+// Generic cell rate algorithm: `tat` is when the bucket would be full
+// again, were the requests spaced evenly at the rate.
+struct bucket
+{
+	clock_type::duration interval;
+	clock_type::duration tolerance;
+	clock_type::time_point tat;
+};
+
+struct rate_limiter
+{
+	std::mutex mu;
+	std::unordered_map<std::string, bucket> buckets;
+};
+
+// leaked on purpose, like the event loops' mutex
+rate_limiter& the_limiter()
+{
+	static auto p = new rate_limiter;
+
+	return *p;
+}
+
+rate_limit const& limit_of(std::string const& host)
+{
+	auto it = pool_config().host_rates.find(host);
+
+	if (it != pool_config().host_rates.end())
+		return it->second;
+
+	return pool_config().host_rate;
+}
+
+}
+
+clock_type::time_point reserve_rate(std::string const& url,
+    clock_type::time_point until)
+{
+	auto now = clock_type::now();
+
+	// without any limit, skip the lock
+	if (pool_config().host_rate.rate <= 0 and
+	    pool_config().host_rates.empty())
+		return now;
+
+	auto host = url_host(url);
+	auto&& lim = limit_of(host);
+
+	if (lim.rate <= 0)
+		return now;
+
+	auto&& rl = the_limiter();
+	std::lock_guard<std::mutex> lk(rl.mu);
+
+	auto it = rl.buckets.find(host);
+
+	if (it == rl.buckets.end())
+	{
+		auto interval = duration_cast<clock_type::duration>(
+		    duration<double>(1 / lim.rate));
+		auto burst = lim.burst < 1 ? 1 : lim.burst;
+		bucket b = { interval,
+		    duration_cast<clock_type::duration>(
+		        interval * (burst - 1)), now };
+
+		it = rl.buckets.emplace(host, b).first;
+	}
+
+	auto&& b = it->second;
+	auto start = b.tat - b.tolerance;
+
+	if (start < now)
+		start = now;
+
+	if (until <= start)
+		return until;
+
+	b.tat = (b.tat < now ? now : b.tat) + b.interval;
+
+	return start;
+}
+
+void lower_host_rates(pool_options& opts)
+{
+	std::map<std::string, rate_limit> m;
+
+	for (auto&& kv : opts.host_rates)
+	{
+		auto host = kv.first;
+
+		for (auto&& c : host)
+			c = char(std::tolower((unsigned char)c));
+
+		m[host] = kv.second;
+	}
+
+	opts.host_rates.swap(m);
+}
+
+void reset_rate_limits()
+{
+	auto&& rl = the_limiter();
+	std::lock_guard<std::mutex> lk(rl.mu);
+
+	rl.buckets.clear();
+}
+
+}
@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_RATE__LIMITER_H
+#define _HTTPVERBS_RATE__LIMITER_H
+
+#include <string>
+#include <chrono>
+
+namespace httpverbs
+{
+
+struct pool_options;
+
+// the lower-cased host name in `url`, without user info or port
+std::string url_host(std::string const& url);
+
+// Takes a token from the bucket of the host of `url`, and returns when
+// the request may start; the token is spent from then on, so the
+// caller must not start the request any earlier.  A request which
+// could not start before `until` takes no token, and gets `until`.
+std::chrono::steady_clock::time_point reserve_rate(std::string const& url,
+    std::chrono::steady_clock::time_point until =
+    std::chrono::steady_clock::time_point::max());
+
+// lower-cases the host names of pool_options::host_rates, so that
+// they match url_host
+void lower_host_rates(pool_options& opts);
+
+// forgets the buckets, which start full again under the options set
+// by the next enable_library
+void reset_rate_limits();
+
+}
+
+#endif
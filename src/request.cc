@@ -24,11 +24,29 @@
  */
 
 #include <httpverbs/request.h>
+#include <httpverbs/engine.h>
 #include <httpverbs/exceptions.h>
 
 #include <boost/assert.hpp>
 
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include "stdex/defer.h"
+
 #include "pooled_perform.h"
+#include "event_loop.h"
+#include "socket_engine.h"
+#include "rate_limiter.h"
+#include "flight_limiter.h"
+#include "latency_tracker.h"
+#include "retry_policy.h"
+#include "cancellation.h"
+#include "dns_cache.h"
+#include "socket_tuning.h"
+#include "pool_config.h"
 #include "ca_info.h"
 
 namespace httpverbs
@@ -40,6 +58,7 @@ void request::_curl_handle_deleter::operator()(void* p) const
 }
 
 static size_t read_string(char*, size_t, size_t, void*);
+static int seek_string(void*, curl_off_t, int);
 static size_t write_string(char*, size_t, size_t, void*);
 static size_t call_function(char*, size_t, size_t, void*);
 static size_t fill_headers(char*, size_t, size_t, void*);
@@ -51,12 +70,28 @@ struct headers_parser_stack
 {
 	bool done_status_line;
 	header_dict& ls;
+
+	// Until the first byte, libcurl's timeout is the first-byte
+	// limit; the status line lifts it to what is left until the
+	// deadline.
+	CURL* handle;
+	bool first_byte_limited;
+	std::chrono::steady_clock::time_point deadline;
 };
 
 }
 
 request::request(char const* method, std::string url) :
 	handle_(curl_easy_init()),
+	priority_(0),
+	deadline_(std::chrono::steady_clock::time_point::max()),
+	timeout_(pool_config().timeout),
+	first_byte_timeout_(pool_config().first_byte_timeout),
+	idempotent_(strcmp(method, "GET") == 0 or
+	    strcmp(method, "HEAD") == 0 or strcmp(method, "OPTIONS") == 0),
+	replayable_(true),
+	body_ignored_(false),
+	body_(keywords::data_from("", 0)),
 	url(std::move(url))
 {
 	if (handle_ == nullptr)
@@ -64,6 +99,12 @@ request::request(char const* method, std::string url) :
 
 	if (curl_easy_setopt(handle_.get(), CURLOPT_CUSTOMREQUEST, method))
 		throw bad_request();
+
+	connect_timeout(pool_config().connect_timeout);
+	low_speed_limit(pool_config().low_speed_limit,
+	    pool_config().low_speed_time);
+	tune_sockets(handle_.get(), pool_config().sockets);
+	bound_connection_age(handle_.get(), pool_config());
 }
 
 request& request::allow_redirects()
@@ -76,26 +117,137 @@ request& request::allow_redirects()
 
 request& request::ignore_response_body()
 {
-	// use a pointer pointing to an invalid location to represent
-	// that the response body is unwanted
-	curl_easy_setopt(handle_.get(), CURLOPT_PRIVATE, (void*)0x1);
+	body_ignored_ = true;
 
 	return *this;
 }
 
-inline
-bool response_body_ignored(CURL* handle)
+request& request::use_http2()
+{
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	if (curl_easy_setopt(handle_.get(), CURLOPT_HTTP_VERSION,
+	    long(CURL_HTTP_VERSION_2TLS)))
+		throw bad_request();
+
+	// wait for a connection to multiplex over rather than opening
+	// one more
+	curl_easy_setopt(handle_.get(), CURLOPT_PIPEWAIT, 1L);
+#else
+	throw bad_request();
+#endif
+
+	return *this;
+}
+
+request& request::use_h2c()
+{
+#if LIBCURL_VERSION_NUM >= 0x073100
+	if (curl_easy_setopt(handle_.get(), CURLOPT_HTTP_VERSION,
+	    long(CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE)))
+		throw bad_request();
+
+	curl_easy_setopt(handle_.get(), CURLOPT_PIPEWAIT, 1L);
+#else
+	throw bad_request();
+#endif
+
+	return *this;
+}
+
+request& request::stream_weight(long w)
+{
+#if LIBCURL_VERSION_NUM >= 0x072e00
+	if (curl_easy_setopt(handle_.get(), CURLOPT_STREAM_WEIGHT, w))
+		throw bad_request();
+#else
+	(void)w;
+#endif
+
+	return *this;
+}
+
+request& request::idempotent()
+{
+	idempotent_ = true;
+
+	return *this;
+}
+
+request& request::priority(int n)
+{
+	priority_ = n;
+
+	return *this;
+}
+
+request& request::deadline(std::chrono::steady_clock::time_point t)
+{
+	deadline_ = t;
+
+	return *this;
+}
+
+request& request::cancel_on(cancellation_token const& t)
+{
+	cancel_ = t.state_;
+
+	return *this;
+}
+
+request& request::connect_timeout(std::chrono::milliseconds d)
+{
+	curl_easy_setopt(handle_.get(), CURLOPT_CONNECTTIMEOUT_MS,
+	    long(d.count()));
+
+	return *this;
+}
+
+request& request::first_byte_timeout(std::chrono::milliseconds d)
+{
+	first_byte_timeout_ = d;
+
+	return *this;
+}
+
+request& request::timeout(std::chrono::milliseconds d)
 {
-	char* no_body;
-	curl_easy_getinfo(handle, CURLINFO_PRIVATE, &no_body);
+	timeout_ = d;
 
-	return no_body != nullptr;
+	return *this;
 }
 
+request& request::low_speed_limit(long bytes_per_second,
+    std::chrono::seconds period)
+{
+	curl_easy_setopt(handle_.get(), CURLOPT_LOW_SPEED_LIMIT,
+	    bytes_per_second);
+	curl_easy_setopt(handle_.get(), CURLOPT_LOW_SPEED_TIME,
+	    long(period.count()));
+
+	return *this;
+}
+
+// the deadline of a perform starting now
+std::chrono::steady_clock::time_point request::time_limit() const
+{
+	auto now = std::chrono::steady_clock::now();
+
+	if (timeout_.count() == 0 or deadline_ - now <= timeout_)
+		return deadline_;
+
+	return now + timeout_;
+}
+
+// The request body is set up first, so it decides whether the
+// transfer may be sent again, and the response body may only veto.
+
 void request::setup_request_body_from_bytes(void* p, length_t n)
 {
 	auto sz = curl_off_t(n);
 
+	replayable_ = true;
+	body_ = *reinterpret_cast<_mini_string_ref*>(p);
+
 	if (sz != 0)
 	{
 		curl_easy_setopt(handle_.get(), CURLOPT_UPLOAD, 1L);
@@ -103,12 +255,17 @@ void request::setup_request_body_from_bytes(void* p, length_t n)
 		curl_easy_setopt(handle_.get(), CURLOPT_READFUNCTION,
 		    read_string);
 		curl_easy_setopt(handle_.get(), CURLOPT_READDATA, p);
+
+		// libcurl rewinds a body it has to send again by itself
+		curl_easy_setopt(handle_.get(), CURLOPT_SEEKFUNCTION,
+		    seek_string);
+		curl_easy_setopt(handle_.get(), CURLOPT_SEEKDATA, p);
 	}
 }
 
 void request::setup_response_body_to_string(void* p)
 {
-	if (not response_body_ignored(handle_.get()))
+	if (not body_ignored_)
 	{
 		curl_easy_setopt(handle_.get(), CURLOPT_WRITEFUNCTION,
 		    write_string);
@@ -122,6 +279,8 @@ void request::setup_request_body_from_callback(void* p, length_t n)
 {
 	auto sz = curl_off_t(n);
 
+	replayable_ = false;
+
 	if (sz != 0)
 	{
 		curl_easy_setopt(handle_.get(), CURLOPT_UPLOAD, 1L);
@@ -129,11 +288,14 @@ void request::setup_request_body_from_callback(void* p, length_t n)
 		curl_easy_setopt(handle_.get(), CURLOPT_READFUNCTION,
 		    call_function);
 		curl_easy_setopt(handle_.get(), CURLOPT_READDATA, p);
+		curl_easy_setopt(handle_.get(), CURLOPT_SEEKFUNCTION,
+		    curl_seek_callback(nullptr));
 	}
 }
 
 void request::setup_response_body_to_callback(void* p)
 {
+	replayable_ = false;
 	curl_easy_setopt(handle_.get(), CURLOPT_WRITEFUNCTION, call_function);
 	curl_easy_setopt(handle_.get(), CURLOPT_WRITEDATA, p);
 }
@@ -159,7 +321,7 @@ T* choose_buffer(T (&arr)[N], std::unique_ptr<T[]>& darr, size_t n)
 	}
 }
 
-void request::perform_on(response& resp)
+void request::setup_transfer(void* hl, void* sk)
 {
 	if (curl_easy_setopt(handle_.get(), CURLOPT_URL, url.data()))
 		throw bad_request();
@@ -172,16 +334,21 @@ void request::perform_on(response& resp)
 
 	curl_easy_setopt(handle_.get(), CURLOPT_USERAGENT, "httpverbs/0.1");
 
+	// the connection pools tell the host by it
+	curl_easy_setopt(handle_.get(), CURLOPT_PRIVATE, &url);
+
+	// the pinned addresses spare the transfer a DNS lookup
+	auto pins = pinned_addresses(url);
+	curl_easy_setopt(handle_.get(), CURLOPT_RESOLVE, pins.get());
+	resolve_ = std::move(pins);
+
 #if defined(CURLRES_ASYNCH)
 	curl_easy_setopt(handle_.get(), CURLOPT_NOSIGNAL, 1L);
 #endif
 
-	std::unique_ptr<curl_slist[]> hll;
-	curl_slist fhll[16];
-
 	if (not headers.empty())
 	{
-		auto buf = choose_buffer(fhll, hll, headers.size());
+		auto buf = reinterpret_cast<curl_slist*>(hl);
 		auto p = buf;
 
 		for (auto it = begin(headers); it != end(headers); ++it)
@@ -198,24 +365,797 @@ void request::perform_on(response& resp)
 
 		curl_easy_setopt(handle_.get(), CURLOPT_HTTPHEADER, buf);
 	}
+	else
+		curl_easy_setopt(handle_.get(), CURLOPT_HTTPHEADER, nullptr);
 
-	headers_parser_stack sk = { false, resp.headers };
-	setup_response_headers(handle_.get(), &sk);
+	setup_response_headers(handle_.get(), sk);
 
-	auto r = pooled_perform(handle_.get());
+	auto& st = *reinterpret_cast<headers_parser_stack*>(sk);
+	st.done_status_line = false;
+	st.handle = handle_.get();
+	st.first_byte_limited = first_byte_timeout_.count() != 0;
+}
 
+static
+void fill_response(CURL* handle, CURLcode r, response& resp)
+{
 	if (r != CURLE_OK)
 		throw bad_response(r);
 
 	long http_code;
-	curl_easy_getinfo(handle_.get(), CURLINFO_RESPONSE_CODE, &http_code);
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &http_code);
 	resp.status_code = int(http_code);
 
 	char* new_url;
-	curl_easy_getinfo(handle_.get(), CURLINFO_EFFECTIVE_URL, &new_url);
+	curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &new_url);
 	resp.url = new_url;
 }
 
+// 0 without a token; throws if cancelled already
+static
+unsigned long long watch_cancel(_cancellation_state* cs,
+    std::function<void()> abort)
+{
+	if (cs == nullptr)
+		return 0;
+
+	auto id = on_cancel(*cs, std::move(abort));
+
+	if (id == 0)
+		throw bad_response(CURLE_ABORTED_BY_CALLBACK);
+
+	return id;
+}
+
+// keeps everything referred by an in-flight handle alive
+struct request::_transfer
+{
+	explicit _transfer(_mini_string_ref sv) :
+		body(sv),
+		sk({ false, resp.headers }),
+		retries(0),
+		replayed(false),
+		delay(0)
+	{}
+
+	response resp;
+	_mini_string_ref body;
+	callback_t reader;
+	callback_t writer;
+	headers_parser_stack sk;
+	std::unique_ptr<curl_slist[]> hll;
+	_done_t done;
+	int retries;
+	bool replayed;			// on a fresh connection
+	std::chrono::milliseconds delay;
+	std::chrono::steady_clock::time_point retry_at;
+	std::chrono::steady_clock::time_point until;
+};
+
+void request::perform_on(response& resp)
+{
+	// a hedged transfer needs an event loop to race in
+	if (hedging())
+	{
+		std::future<response> fut;
+		auto t = std::make_shared<_transfer>(body_);
+		t->done = _fulfill(fut);
+		setup_request_body_from_bytes(&t->body, body_.size());
+		setup_response_body_to_string(&t->resp.content);
+
+		start_transfer(nullptr, std::move(t));
+		resp = fut.get();
+
+		return;
+	}
+
+	// a blocking transfer never waits in line, but it may be late
+	auto until = time_limit();
+
+	if (until <= std::chrono::steady_clock::now())
+		throw bad_response(CURLE_OPERATION_TIMEDOUT);
+
+	auto start = reserve_rate(url, until);
+
+	if (until <= start)
+		throw bad_response(CURLE_OPERATION_TIMEDOUT);
+
+	if (not sleep_until(cancel_.get(), start))
+		throw bad_response(CURLE_ABORTED_BY_CALLBACK);
+
+	std::unique_ptr<curl_slist[]> hll;
+	curl_slist fhll[16];
+	headers_parser_stack sk = { false, resp.headers };
+
+	setup_transfer(choose_buffer(fhll, hll, headers.size()), &sk);
+	sk.deadline = until;
+
+	if (pool_config().retries.max_retries > 0)
+		earn_retry();
+
+	perform_interrupt intr;
+	auto cid = watch_cancel(cancel_.get(), [&]
+	    {
+		intr.trigger();
+	    });
+
+	defer(if (cid != 0) forget_cancel(*cancel_, cid));
+
+	auto body = body_;
+	CURLcode r;
+	std::chrono::milliseconds delay(0);
+	int retries = 0;
+	bool replayed = false;
+
+	while (1)
+	{
+		limit_transfer_time(handle_.get(), until, first_byte_timeout_);
+		r = pooled_perform(handle_.get(), cid != 0 ? &intr : nullptr);
+
+		if (replayed)
+			curl_easy_setopt(handle_.get(), CURLOPT_FRESH_CONNECT,
+			    0L);
+
+		// the adaptive limits learn from the blocking transfers too
+		if (pool_config().adaptive_host_in_flight)
+			observe_flight(url_host(url), handle_.get(), r);
+
+		std::chrono::milliseconds wait(0);
+
+		if (not replayed and replay_on_fresh_connection(handle_.get(),
+		    r, idempotent_, replayable_))
+		{
+			replayed = true;
+			curl_easy_setopt(handle_.get(), CURLOPT_FRESH_CONNECT,
+			    1L);
+		}
+		else if (plan_retry(handle_.get(), r, idempotent_, replayable_,
+		    retries, delay))
+		{
+			++retries;
+			wait = delay;
+		}
+		else
+			break;
+
+		// too late to go again; keep the token for someone else
+		auto at = std::chrono::steady_clock::now() + wait;
+
+		if (until <= at)
+			break;
+
+		at = std::max(at, reserve_rate(url, until));
+
+		if (until <= at)
+			break;
+
+		if (not sleep_until(cancel_.get(), at))
+		{
+			r = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+
+		// a retry starts over; only the bytes bodies get sent again
+		resp = response();
+		sk.done_status_line = false;
+		sk.first_byte_limited = first_byte_timeout_.count() != 0;
+
+		if (replayable_)
+		{
+			body = body_;
+			setup_request_body_from_bytes(&body, body.size());
+			setup_response_body_to_string(&resp.content);
+		}
+	}
+
+	fill_response(handle_.get(), r, resp);
+}
+
+// A batch held back by the rate limits or the in-flight limits runs in
+// an engine, which starts each transfer on time rather than all of them
+// at once, driving the thread's pool so that the connections are
+// reused by the next batch.
+static
+void perform_paced(CURL** handles, transfer_order const* orders, size_t n,
+    CURLcode* rs)
+{
+	with_thread_pool([&](CURLM* pool)
+	    {
+		socket_engine eng(pool);
+
+		for (size_t i = 0; i < n; ++i)
+			eng.submit(handles[i], orders[i], [=](CURLcode r)
+			    {
+				rs[i] = r;
+			    });
+
+		while (eng.running() != 0)
+			eng.poll(-1);
+	    });
+}
+
+std::vector<response> _perform_all(request** reqs, size_t n)
+{
+	std::vector<std::unique_ptr<request::_transfer>> ts;
+	std::vector<CURL*> handles;
+	std::vector<CURLcode> rs(n);
+
+	ts.reserve(n);
+	handles.reserve(n);
+
+	auto now = std::chrono::steady_clock::now();
+	std::vector<transfer_order> orders(n);
+	std::vector<size_t> live;
+	bool paced = pool_config().max_in_flight > 0 or limits_hosts();
+
+	// one past its deadline fails without being sent, but does not
+	// hold the others back
+	for (size_t i = 0; i < n; ++i)
+	{
+		orders[i].deadline = reqs[i]->time_limit();
+		orders[i].first_byte = reqs[i]->first_byte_timeout_;
+
+		if (orders[i].deadline <= now)
+			rs[i] = CURLE_OPERATION_TIMEDOUT;
+		else
+			live.push_back(i);
+	}
+
+	for (auto i : live)
+	{
+		orders[i].not_before = reserve_rate(reqs[i]->url,
+		    orders[i].deadline);
+
+		if (limits_hosts())
+			orders[i].host = url_host(reqs[i]->url);
+
+		// an unlimited host is due at the time of the call
+		if (orders[i].not_before > std::chrono::steady_clock::now())
+			paced = true;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		auto& req = *reqs[i];
+		auto sv = keywords::data_from(req.content);
+		ts.push_back(std::unique_ptr<request::_transfer>(
+		    new request::_transfer(sv)));
+		auto t = ts.back().get();
+
+		req.setup_request_body_from_bytes(&t->body, sv.size());
+		req.setup_response_body_to_string(&t->resp.content);
+		t->hll.reset(new curl_slist[req.headers.size()]);
+		req.setup_transfer(t->hll.get(), &t->sk);
+		t->sk.deadline = orders[i].deadline;
+
+		handles.push_back(req.handle_.get());
+	}
+
+	auto run = [&](std::vector<size_t> const& which)
+	    {
+		std::vector<CURL*> hs;
+		std::vector<transfer_order> os;
+		std::vector<CURLcode> results(which.size());
+
+		for (auto i : which)
+		{
+			hs.push_back(handles[i]);
+			os.push_back(orders[i]);
+		}
+
+		if (paced)
+			perform_paced(hs.data(), os.data(), hs.size(),
+			    results.data());
+		else
+		{
+			for (size_t k = 0; k < hs.size(); ++k)
+				limit_transfer_time(hs[k], os[k].deadline,
+				    os[k].first_byte);
+
+			pooled_perform_all(hs.data(), hs.size(),
+			    results.data());
+		}
+
+		for (size_t k = 0; k < which.size(); ++k)
+			rs[which[k]] = results[k];
+	    };
+
+	if (not live.empty())
+		run(live);
+
+	// those which met a connection closed by the server go once more
+	std::vector<size_t> again;
+	now = std::chrono::steady_clock::now();
+
+	for (auto i : live)
+	{
+		if (now < orders[i].deadline and
+		    replay_on_fresh_connection(handles[i], rs[i],
+		    reqs[i]->idempotent_, reqs[i]->replayable_))
+		{
+			ts[i]->resp = response();
+			ts[i]->body.seek(0);
+			ts[i]->sk.done_status_line = false;
+			ts[i]->sk.first_byte_limited =
+			    orders[i].first_byte.count() != 0;
+			curl_easy_setopt(handles[i], CURLOPT_FRESH_CONNECT, 1L);
+
+			again.push_back(i);
+		}
+	}
+
+	if (not again.empty())
+	{
+		run(again);
+
+		for (auto i : again)
+			curl_easy_setopt(handles[i], CURLOPT_FRESH_CONNECT, 0L);
+	}
+
+	std::vector<response> resps;
+	resps.reserve(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		fill_response(handles[i], rs[i], ts[i]->resp);
+		resps.push_back(std::move(ts[i]->resp));
+	}
+
+	return resps;
+}
+
+void request::start_on(engine* e, _mini_string_ref sv, _done_t done)
+{
+	auto t = std::make_shared<_transfer>(sv);
+	t->done = std::move(done);
+	setup_request_body_from_bytes(&t->body, sv.size());
+	setup_response_body_to_string(&t->resp.content);
+
+	start_transfer(e, std::move(t));
+}
+
+void request::start_on(engine* e, _mini_string_ref sv, callback_t writer,
+    _done_t done)
+{
+	auto t = std::make_shared<_transfer>(sv);
+	t->writer = std::move(writer);
+	t->done = std::move(done);
+	setup_request_body_from_bytes(&t->body, sv.size());
+	setup_response_body_to_callback(&t->writer);
+
+	start_transfer(e, std::move(t));
+}
+
+void request::start_on(engine* e, length_t n, callback_t reader,
+    _done_t done)
+{
+	auto t = std::make_shared<_transfer>(keywords::data_from("", 0));
+	t->reader = std::move(reader);
+	t->done = std::move(done);
+	setup_request_body_from_callback(&t->reader, n);
+	setup_response_body_to_string(&t->resp.content);
+
+	start_transfer(e, std::move(t));
+}
+
+void request::start_on(engine* e, length_t n, callback_t reader,
+    callback_t writer, _done_t done)
+{
+	auto t = std::make_shared<_transfer>(keywords::data_from("", 0));
+	t->reader = std::move(reader);
+	t->writer = std::move(writer);
+	t->done = std::move(done);
+	setup_request_body_from_callback(&t->reader, n);
+	setup_response_body_to_callback(&t->writer);
+
+	start_transfer(e, std::move(t));
+}
+
+auto request::_fulfill(std::future<response>& fut) -> _done_t
+{
+	// std::function wants a copyable target
+	auto pr = std::make_shared<std::promise<response>>();
+	fut = pr->get_future();
+
+	return [=](std::exception_ptr ep, response resp)
+	    {
+		if (ep)
+			pr->set_exception(std::move(ep));
+		else
+			pr->set_value(std::move(resp));
+	    };
+}
+
+auto request::_dispatch(_completion c) -> _done_t
+{
+	if (not c.executor)
+		return std::move(c.handler);
+
+	auto handler = std::move(c.handler);
+	auto executor = std::move(c.executor);
+
+	return [=](std::exception_ptr ep, response resp)
+	    {
+		auto p = std::make_shared<response>(std::move(resp));
+
+		executor([=]
+		    {
+			handler(ep, std::move(*p));
+		    });
+	    };
+}
+
+static
+unsigned long long new_ticket()
+{
+	static std::atomic<unsigned long long> n(0);
+
+	return ++n;
+}
+
+static
+double total_time(CURL* handle)
+{
+	double s = 0;
+	curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &s);
+
+	return s;
+}
+
+// a timeout tells that the latency is at least as long
+static
+bool tells_latency(CURLcode r)
+{
+	return r == CURLE_OK or r == CURLE_OPERATION_TIMEDOUT;
+}
+
+bool request::hedging() const
+{
+	return pool_config().hedge_idempotent and idempotent_ and replayable_;
+}
+
+void request::start_transfer(engine* e, std::shared_ptr<_transfer> t)
+{
+	bool first = t->retries == 0 and not t->replayed;
+
+	if (first)
+		t->until = time_limit();
+
+	t->hll.reset(new curl_slist[headers.size()]);
+	setup_transfer(t->hll.get(), &t->sk);
+	t->sk.deadline = t->until;
+
+	// the latencies of the hedged requests tell when to hedge
+	std::string host;
+
+	if (hedging() and first)
+	{
+		host = url_host(url);
+		std::chrono::microseconds delay = pool_config().hedge_delay;
+
+		if (plan_hedge(host, pool_config().hedge_budget, 0.95, delay))
+		{
+			start_hedged(e, std::move(t), delay);
+			return;
+		}
+	}
+
+	if (first and pool_config().retries.max_retries > 0)
+		earn_retry();
+
+	auto handle = handle_.get();
+	auto ticket = new_ticket();
+	auto cs = cancel_;
+	auto cid = watch_cancel(cs.get(), [=]
+	    {
+		if (e == nullptr)
+			cancel_transfer(handle, ticket);
+		else
+			e->impl_->cancel(handle, ticket);
+	    });
+
+	// nothing here may touch the request after the handler runs
+	transfer_handler on_done = [=](CURLcode r)
+	    {
+		std::exception_ptr ep;
+
+		if (cid != 0)
+			forget_cancel(*cs, cid);
+
+		if (not host.empty() and tells_latency(r))
+			record_latency(host, total_time(handle));
+
+		if (t->replayed)
+			curl_easy_setopt(handle, CURLOPT_FRESH_CONNECT, 0L);
+
+		try
+		{
+			auto now = std::chrono::steady_clock::now();
+
+			if (not t->replayed and now < t->until and
+			    replay_on_fresh_connection(handle, r, idempotent_,
+			    replayable_))
+			{
+				t->replayed = true;
+				t->resp = response();
+				t->body.seek(0);
+				curl_easy_setopt(handle, CURLOPT_FRESH_CONNECT,
+				    1L);
+
+				start_transfer(e, t);
+				return;
+			}
+
+			if (plan_retry(handle, r, idempotent_, replayable_,
+			    t->retries, t->delay))
+			{
+				auto at = now + t->delay;
+
+				if (at < t->until)
+				{
+					// a retry starts over
+					++t->retries;
+					t->retry_at = at;
+					t->resp = response();
+					t->body.seek(0);
+
+					start_transfer(e, t);
+					return;
+				}
+			}
+
+			fill_response(handle, r, t->resp);
+		}
+		catch (...)
+		{
+			ep = std::current_exception();
+		}
+
+		t->done(std::move(ep), std::move(t->resp));
+	    };
+
+	transfer_order order;
+	order.priority = priority_;
+	order.deadline = t->until;
+	order.first_byte = first_byte_timeout_;
+	order.not_before = std::max(reserve_rate(url, t->until),
+	    t->retry_at);
+	order.ticket = ticket;
+	order.cancel = cs;
+
+	if (limits_hosts())
+		order.host = url_host(url);
+
+	try
+	{
+		if (e == nullptr)
+			submit_transfer(handle, url, order, std::move(on_done));
+		else
+			e->impl_->submit(handle, order, std::move(on_done));
+	}
+	catch (...)
+	{
+		if (cid != 0)
+			forget_cancel(*cs, cid);
+
+		throw;
+	}
+
+	// a cancellation ahead of the submission found nothing to abort
+	if (cid != 0)
+		recheck_cancel(*cs, cid);
+}
+
+// Two transfers of the same request, the second held back by the
+// hedging delay.  The first to finish cancels the other, and the
+// completion waits for the cancellation, since the loser still reads
+// the request's headers.
+struct request::_hedge
+{
+	_hedge() :
+		pending(2),
+		settled(false)
+	{}
+
+	std::mutex mu;
+	int pending;
+	bool settled;
+	int winner;
+	CURLcode result;
+	transfer_order::clock_type::time_point start;
+	double took;
+	CURL* handles[2];
+	unsigned long long tickets[2];
+	std::shared_ptr<_transfer> ts[2];
+	std::unique_ptr<void, _curl_handle_deleter> dup;
+	std::string host;
+	_done_t done;
+	std::shared_ptr<_cancellation_state> cs;
+	unsigned long long cid;
+};
+
+void request::start_hedged(engine* e, std::shared_ptr<_transfer> t,
+    std::chrono::microseconds delay)
+{
+	auto h = std::make_shared<_hedge>();
+	auto until = t->until;
+	auto dup = curl_easy_duphandle(handle_.get());
+
+	if (dup == nullptr)
+		throw bad_request();
+
+	h->dup.reset(dup);
+
+	// the duplicate reads and writes its own copies
+	auto t2 = std::make_shared<_transfer>(t->body);
+	curl_easy_setopt(dup, CURLOPT_READDATA, &t2->body);
+	curl_easy_setopt(dup, CURLOPT_SEEKDATA, &t2->body);
+	curl_easy_setopt(dup, CURLOPT_HEADERDATA, &t2->sk);
+	t2->sk.handle = dup;
+	t2->sk.first_byte_limited = t->sk.first_byte_limited;
+	t2->sk.deadline = t->sk.deadline;
+
+	if (not body_ignored_)
+		curl_easy_setopt(dup, CURLOPT_WRITEDATA, &t2->resp.content);
+
+	// on a connection other than the one which is slow
+	curl_easy_setopt(dup, CURLOPT_FRESH_CONNECT, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	curl_easy_setopt(dup, CURLOPT_PIPEWAIT, 0L);
+#endif
+
+	h->handles[0] = handle_.get();
+	h->handles[1] = dup;
+	h->tickets[0] = new_ticket();
+	h->tickets[1] = new_ticket();
+	h->done = std::move(t->done);
+	h->ts[0] = std::move(t);
+	h->ts[1] = std::move(t2);
+	h->host = url_host(url);
+	h->cs = cancel_;
+
+	auto abort = [=](int i)
+	    {
+		if (e == nullptr)
+			cancel_transfer(h->handles[i], h->tickets[i]);
+		else
+			e->impl_->cancel(h->handles[i], h->tickets[i]);
+	    };
+
+	auto finish = [=](int i, CURLcode r)
+	    {
+		std::unique_lock<std::mutex> lk(h->mu);
+		--h->pending;
+
+		if (not h->settled)
+		{
+			h->settled = true;
+			h->winner = i;
+			h->result = r;
+			h->took = std::chrono::duration<double>(
+			    transfer_order::clock_type::now() - h->start)
+			    .count();
+
+			if (h->pending != 0)
+				abort(1 - i);
+		}
+
+		if (h->pending != 0)
+			return;
+
+		lk.unlock();
+
+		if (h->cid != 0)
+			forget_cancel(*h->cs, h->cid);
+
+		auto w = h->winner;
+		auto handle = h->handles[w];
+		auto&& tw = *h->ts[w];
+		std::exception_ptr ep;
+
+		// from the first one's start, even if the hedge won, or the
+		// hedges would hide how slow the host is
+		if (tells_latency(h->result))
+			record_latency(h->host, h->took);
+
+		try
+		{
+			fill_response(handle, h->result, tw.resp);
+		}
+		catch (...)
+		{
+			ep = std::current_exception();
+		}
+
+		h->done(std::move(ep), std::move(tw.resp));
+	    };
+
+	transfer_order orders[2];
+
+	for (auto&& order : orders)
+	{
+		order.priority = priority_;
+		order.deadline = until;
+		order.first_byte = first_byte_timeout_;
+		order.cancel = h->cs;
+
+		if (limits_hosts())
+			order.host = h->host;
+	}
+
+	orders[0].not_before = reserve_rate(url, until);
+	h->start = std::max(transfer_order::clock_type::now(),
+	    orders[0].not_before);
+
+	for (int i = 0; i < 2; ++i)
+		orders[i].ticket = h->tickets[i];
+
+	// The hedge is a request to the host like any other, so it needs
+	// a token of its own; without one, or too late for the deadline,
+	// where it would win with a timeout, it is not sent.
+	auto due = std::max(orders[0].not_before,
+	    transfer_order::clock_type::now() + delay);
+	int n = 1;
+
+	if (due < until)
+	{
+		orders[1].not_before = std::max(due, reserve_rate(url, until));
+
+		if (orders[1].not_before < until)
+			n = 2;
+	}
+
+	if (n == 1)
+		h->pending = 1;
+
+	h->cid = watch_cancel(h->cs.get(), [=]
+	    {
+		abort(0);
+
+		if (n == 2)
+			abort(1);
+	    });
+
+	auto submit = [&](int i)
+	    {
+		transfer_handler on_done = [=](CURLcode r)
+		    {
+			finish(i, r);
+		    };
+
+		if (e == nullptr)
+			submit_transfer(h->handles[i], url, orders[i],
+			    std::move(on_done));
+		else
+			e->impl_->submit(h->handles[i], orders[i],
+			    std::move(on_done));
+	    };
+
+	try
+	{
+		// the hedge goes first, so that it is there to be cancelled
+		if (n == 2)
+			submit(1);
+
+		submit(0);
+	}
+	catch (...)
+	{
+		// the caller learns from the exception; the hedge, if in,
+		// has no one to report to
+		if (n == 2)
+			abort(1);
+
+		if (h->cid != 0)
+			forget_cancel(*h->cs, h->cid);
+
+		throw;
+	}
+
+	if (h->cid != 0)
+		recheck_cancel(*h->cs, h->cid);
+}
+
 size_t read_string(char* to, size_t, size_t nmemb, void* from)
 {
 	auto& sv = *reinterpret_cast<_mini_string_ref*>(from);
@@ -226,6 +1166,16 @@ size_t read_string(char* to, size_t, size_t nmemb, void* from)
 	return copied_size;
 }
 
+int seek_string(void* p, curl_off_t offset, int origin)
+{
+	auto& sv = *reinterpret_cast<_mini_string_ref*>(p);
+
+	if (origin != SEEK_SET)
+		return CURL_SEEKFUNC_CANTSEEK;
+
+	return sv.seek(size_t(offset)) ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
+}
+
 size_t write_string(char* from, size_t, size_t nmemb, void* to)
 {
 	auto& s = *reinterpret_cast<std::string*>(to);
@@ -252,6 +1202,12 @@ size_t fill_headers(char* from, size_t, size_t nmemb, void* to)
 	{
 		sk.done_status_line = true;
 		sk.ls.clear();
+
+		if (sk.first_byte_limited)
+		{
+			lift_first_byte_limit(sk.handle, sk.deadline);
+			sk.first_byte_limited = false;
+		}
 	}
 	else
 	{
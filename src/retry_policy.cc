@@ -0,0 +1,277 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <httpverbs/stats.h>
+
+#include "retry_policy.h"
+#include "pool_config.h"
+
+#include <mutex>
+#include <random>
+#include <algorithm>
+
+namespace httpverbs
+{
+
+using namespace std::chrono;
+
+namespace
+{
+
+// the earnings of the last this many requests, at most
+double const earnings_kept = 1000;
+
+// differs by process, so that the processes failing together do not
+// retry in step; the clock covers a random_device which is not random
+unsigned jitter_seed()
+{
+	std::random_device rd;
+
+	return rd() ^ unsigned(system_clock::now().time_since_epoch().count());
+}
+
+struct retry_budget
+{
+	retry_budget() :
+		earned(0),
+		floor(-1),
+		rng(jitter_seed()),
+		retried(0),
+		denied(0),
+		replayed(0)
+	{}
+
+	std::mutex mu;
+	double earned;
+	double floor;			// refilled at min_budget a second
+	steady_clock::time_point refilled;
+	std::mt19937 rng;
+	unsigned long long retried;
+	unsigned long long denied;
+	unsigned long long replayed;
+};
+
+// leaked on purpose, like the rate limiter
+retry_budget& the_budget()
+{
+	static auto p = new retry_budget;
+
+	return *p;
+}
+
+bool retry_after(CURL* handle, milliseconds& d)
+{
+#if LIBCURL_VERSION_NUM >= 0x074200
+	curl_off_t s = 0;
+
+	if (curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &s) or s <= 0)
+		return false;
+
+	d = seconds(s);
+
+	return true;
+#else
+	(void)handle;
+	(void)d;
+
+	return false;
+#endif
+}
+
+enum class failure
+{
+	permanent,
+	never_sent,		// safe to send once more
+	rejected,		// 429, turned away before being processed
+	transient		// for idempotent requests only
+};
+
+failure classify(CURL* handle, CURLcode r)
+{
+	switch (r)
+	{
+	case CURLE_OK:
+	{
+		long code = 0;
+		curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+
+		if (code == 429)
+			return failure::rejected;
+
+		if (code == 502 or code == 503 or code == 504)
+			return failure::transient;
+
+		return failure::permanent;
+	}
+	case CURLE_COULDNT_CONNECT:
+		return failure::never_sent;
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	{
+		// dropped by the server while idle in the pool; on a new
+		// connection, the server may be in trouble
+		long n = -1;
+		curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &n);
+
+		return n == 0 ? failure::transient : failure::permanent;
+	}
+	default:
+		return failure::permanent;
+	}
+}
+
+}
+
+void earn_retry()
+{
+	auto&& b = the_budget();
+	std::lock_guard<std::mutex> lk(b.mu);
+
+	b.earned = std::min(b.earned + pool_config().retries.budget,
+	    pool_config().retries.budget * earnings_kept);
+}
+
+bool plan_retry(CURL* handle, CURLcode r, bool idempotent,
+    bool replayable, int retries, milliseconds& delay)
+{
+	auto&& policy = pool_config().retries;
+
+	if (retries >= policy.max_retries)
+		return false;
+
+	switch (classify(handle, r))
+	{
+	case failure::permanent:
+		return false;
+	case failure::never_sent:
+		break;
+	case failure::rejected:
+		if (not replayable or
+		    (not idempotent and not policy.retry_rejected))
+			return false;
+		break;
+	case failure::transient:
+		if (not idempotent or not replayable)
+			return false;
+		break;
+	}
+
+	// not worth waiting for longer than max_delay
+	milliseconds after(0);
+
+	if (retry_after(handle, after) and after > policy.max_delay)
+		return false;
+
+	auto&& b = the_budget();
+	std::lock_guard<std::mutex> lk(b.mu);
+	auto now = steady_clock::now();
+
+	if (b.floor < 0)
+		b.floor = policy.min_budget;
+	else
+		b.floor = std::min(b.floor + policy.min_budget *
+		    duration<double>(now - b.refilled).count(),
+		    policy.min_budget);
+
+	b.refilled = now;
+
+	if (b.earned >= 1)
+		b.earned -= 1;
+	else if (b.floor >= 1)
+		b.floor -= 1;
+	else
+	{
+		++b.denied;
+		return false;
+	}
+
+	++b.retried;
+
+	// decorrelated jitter: up to thrice the last delay
+	auto lo = policy.base_delay.count();
+	auto hi = std::max(lo, std::min(policy.max_delay.count(),
+	    std::max(delay.count(), lo) * 3));
+	std::uniform_int_distribution<long long> pick(lo, hi);
+	delay = milliseconds(pick(b.rng));
+
+	if (after > delay)
+		delay = after;
+
+	return true;
+}
+
+bool replay_on_fresh_connection(CURL* handle, CURLcode r, bool idempotent,
+    bool replayable)
+{
+	if (not replayable or (r != CURLE_SEND_ERROR and
+	    r != CURLE_RECV_ERROR and r != CURLE_GOT_NOTHING))
+		return false;
+
+	long connects = -1;
+	long code = -1;
+	long received = -1;
+	long sent = -1;
+
+	curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+	curl_easy_getinfo(handle, CURLINFO_HEADER_SIZE, &received);
+	curl_easy_getinfo(handle, CURLINFO_REQUEST_SIZE, &sent);
+
+	// a 100 Continue is no response, but tells that the request got
+	// through
+	if (connects != 0 or code >= 200 or
+	    (not idempotent and (sent != 0 or received != 0)))
+		return false;
+
+	auto&& b = the_budget();
+	std::lock_guard<std::mutex> lk(b.mu);
+	++b.replayed;
+
+	return true;
+}
+
+void reset_retry_budget()
+{
+	auto&& b = the_budget();
+	std::lock_guard<std::mutex> lk(b.mu);
+
+	b.earned = 0;
+	b.floor = -1;
+	b.retried = 0;
+	b.denied = 0;
+	b.replayed = 0;
+}
+
+retry_stats transfer_retry_stats()
+{
+	auto&& b = the_budget();
+	std::lock_guard<std::mutex> lk(b.mu);
+	retry_stats st = { b.retried, b.denied, b.replayed };
+
+	return st;
+}
+
+}
@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_RETRY__POLICY_H
+#define _HTTPVERBS_RETRY__POLICY_H
+
+#include <curl/curl.h>
+
+#include <chrono>
+
+namespace httpverbs
+{
+
+// counts a request toward the retry budget of pool_options::retries
+void earn_retry();
+
+// Whether a transfer of `handle` which ended with `r`, after
+// `retries` retries so far, should go again, and after how long.
+// `delay` brings in the previous delay, which the jitter grows from;
+// `replayable` says the bodies can be sent and received again.
+bool plan_retry(CURL* handle, CURLcode r, bool idempotent,
+    bool replayable, int retries, std::chrono::milliseconds& delay);
+
+// Whether a transfer which failed on a reused connection, before the
+// response came back, should go once more on a new one: the server
+// closed the connection while it sat in the pool.  It is safe
+// for the idempotent requests, and for the others if none of their
+// bytes were sent.  Unlike the retries, it costs no budget and does
+// not wait.
+bool replay_on_fresh_connection(CURL* handle, CURLcode r, bool idempotent,
+    bool replayable);
+
+void reset_retry_budget();
+
+}
+
+#endif
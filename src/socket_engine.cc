@@ -0,0 +1,631 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <httpverbs/exceptions.h>
+
+#include "socket_engine.h"
+#include "pooled_perform.h"
+#include "pool_config.h"
+#include "flight_limiter.h"
+#include "connection_stats.h"
+#include "stdex/defer.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(WIN32)
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <cstdint>
+#include <climits>
+#include <unordered_set>
+#include <utility>
+
+namespace httpverbs
+{
+
+using namespace std::chrono;
+
+socket_engine::socket_engine() :
+	socket_engine(new_multi_handle(connection_stats::per_loop), true)
+{}
+
+socket_engine::socket_engine(CURLM* pool) :
+	socket_engine(pool, false)
+{}
+
+socket_engine::socket_engine(CURLM* multi, bool owned) :
+	multi_(multi),
+	owns_multi_(owned),
+	max_running_(size_t(pool_config().max_transfers)),
+	timer_armed_(false),
+	poller_(std::this_thread::get_id())
+{
+	defer(if (owns_multi_) free_multi_handle(multi_)) namely(guard);
+
+#if defined(__linux__)
+	epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epfd_ == -1)
+		throw bad_connection_pool();
+
+	defer(close(epfd_)) namely(epfd_guard);
+
+	wakefd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (wakefd_ == -1)
+		throw bad_connection_pool();
+
+	defer(close(wakefd_)) namely(wakefd_guard);
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = wakefd_;
+
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) == -1)
+		throw bad_connection_pool();
+
+	epfd_guard.dismiss();
+	wakefd_guard.dismiss();
+#elif !defined(WIN32)
+	if (pipe(wakefd_) == -1)
+		throw bad_connection_pool();
+
+	for (auto fd : wakefd_)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, on_socket);
+	curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, on_timer);
+	curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+
+	register_engine(this);
+	guard.dismiss();
+}
+
+socket_engine::~socket_engine()
+{
+	unregister_engine(this);
+	abort_running(CURLE_ABORTED_BY_CALLBACK);
+
+	auto abort = [](pending_transfer& t)
+	    {
+		leave_queue();
+		t.on_done(CURLE_ABORTED_BY_CALLBACK);
+	    };
+
+	waiting_.clear(abort);
+
+	for (auto&& t : delayed_)
+		abort(t.second);
+
+	for (auto&& t : incoming_)
+		abort(t);
+
+	// closing the cached connections still calls on_socket
+	if (owns_multi_)
+		free_multi_handle(multi_);
+	else
+	{
+		curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, nullptr);
+		curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, nullptr);
+		curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, nullptr);
+		curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, nullptr);
+	}
+
+#if defined(__linux__)
+	close(wakefd_);
+	close(epfd_);
+#elif !defined(WIN32)
+	close(wakefd_[0]);
+	close(wakefd_[1]);
+#endif
+}
+
+void socket_engine::submit(CURL* handle, transfer_order order,
+    transfer_handler on_done)
+{
+	// may block, so not under the lock
+	enter_queue(order.cancel.get());
+
+	pending_transfer t = { handle, order, std::move(on_done),
+	    clock_type::now() };
+
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		incoming_.push_back(std::move(t));
+	}
+
+	wakeup();
+}
+
+void socket_engine::cancel(CURL* handle, unsigned long long ticket)
+{
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		cancels_.push_back(std::make_pair(handle, ticket));
+	}
+
+	wakeup();
+}
+
+void socket_engine::wakeup()
+{
+	// a full counter or pipe already means a pending wakeup
+#if defined(__linux__)
+	uint64_t one = 1;
+	auto r = write(wakefd_, &one, sizeof(one));
+	(void)r;
+#elif !defined(WIN32)
+	char c = 0;
+	auto r = write(wakefd_[1], &c, 1);
+	(void)r;
+#endif
+}
+
+size_t socket_engine::running()
+{
+	std::lock_guard<std::mutex> lk(mu_);
+
+	return running_.size() + waiting_.size() + delayed_.size() +
+	    incoming_.size();
+}
+
+size_t socket_engine::poll(int timeout_ms)
+{
+	poller_ = std::this_thread::get_id();
+
+	auto n = add_incoming();
+	n += admit();
+	wait_events(wait_time(timeout_ms));
+
+	if (timer_armed_ and clock_type::now() >= timer_)
+	{
+		timer_armed_ = false;
+		act(CURL_SOCKET_TIMEOUT, 0);
+	}
+
+	n += finish_done();
+
+	// the finished transfers made room, and their handlers may
+	// have cancelled others
+	n += add_incoming();
+
+	return n + admit();
+}
+
+// takes the cancellations along, after the submissions they may
+// refer to
+size_t socket_engine::add_incoming()
+{
+	std::vector<pending_transfer> ls;
+	std::vector<std::pair<CURL*, unsigned long long>> cs;
+	size_t n = 0;
+
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		ls.swap(incoming_);
+		cs.swap(cancels_);
+	}
+
+	for (auto&& t : ls)
+	{
+		// the rate limits would hold it back past its deadline
+		if (t.order.not_before >= t.order.deadline)
+		{
+			leave_queue();
+			t.on_done(CURLE_OPERATION_TIMEDOUT);
+			++n;
+		}
+		else
+			delayed_.emplace(t.order.not_before, std::move(t));
+	}
+
+	for (auto&& c : cs)
+		n += cancel_one(c.first, c.second);
+
+	return n;
+}
+
+size_t socket_engine::cancel_one(CURL* handle, unsigned long long ticket)
+{
+	auto it = running_.find(handle);
+
+	if (it != running_.end())
+	{
+		if (it->second.ticket != ticket)
+			return 0;
+
+		auto t = std::move(it->second);
+		running_.erase(it);
+
+		curl_multi_remove_handle(multi_, handle);
+		curl_easy_setopt(handle, CURLOPT_SHARE, nullptr);
+		end_pool_transfer(handle);
+		end_flight(t.host);
+		t.on_done(CURLE_ABORTED_BY_CALLBACK);
+
+		return 1;
+	}
+
+	auto same = [&](pending_transfer const& t)
+	    {
+		return t.handle == handle and t.order.ticket == ticket;
+	    };
+
+	pending_transfer t;
+
+	for (auto dt = delayed_.begin(); dt != delayed_.end(); ++dt)
+	{
+		if (same(dt->second))
+		{
+			t = std::move(dt->second);
+			delayed_.erase(dt);
+			break;
+		}
+	}
+
+	// finished already
+	if (t.on_done == nullptr and not waiting_.pop_if(t, same))
+		return 0;
+
+	leave_queue();
+	t.on_done(CURLE_ABORTED_BY_CALLBACK);
+
+	return 1;
+}
+
+size_t socket_engine::admit()
+{
+	auto now = clock_type::now();
+
+	while (not delayed_.empty() and delayed_.begin()->first <= now)
+	{
+		waiting_.push(std::move(delayed_.begin()->second));
+		delayed_.erase(delayed_.begin());
+	}
+
+	auto n = waiting_.drop_expired(now, [](pending_transfer& t)
+	    {
+		leave_queue();
+		t.on_done(CURLE_OPERATION_TIMEDOUT);
+	    });
+
+	// without per-host limits, one refusal means they all are; with
+	// them, one means the host's are
+	bool per_host = limits_hosts();
+	bool full = false;
+	std::unordered_set<std::string> refused;
+	auto admissible = [&](pending_transfer const& t)
+	    {
+		if (full or refused.count(t.order.host))
+			return false;
+
+		if (try_start_flight(t.order.host, t.submitted, this))
+			return true;
+
+		if (per_host)
+			refused.insert(t.order.host);
+		else
+			full = true;
+
+		return false;
+	    };
+
+	auto room = [&]
+	    {
+		return max_running_ == 0 or running_.size() < max_running_;
+	    };
+
+	auto start = [&](pending_transfer& t)
+	    {
+		curl_easy_setopt(t.handle, CURLOPT_SHARE, share_handle());
+		limit_transfer_time(t.handle, t.order.deadline,
+		    t.order.first_byte);
+		start_pool_transfer(multi_, t.handle);
+
+		// libcurl arms the timer to kick off the transfer
+		if (curl_multi_add_handle(multi_, t.handle))
+		{
+			curl_easy_setopt(t.handle, CURLOPT_SHARE, nullptr);
+			end_pool_transfer(t.handle);
+			end_flight(t.order.host);
+			t.on_done(CURLE_OUT_OF_MEMORY);
+			++n;
+		}
+		else
+		{
+			running_transfer rt = { std::move(t.on_done),
+			    std::move(t.order.host), t.order.ticket };
+			running_.emplace(t.handle, std::move(rt));
+		}
+
+		return room();
+	    };
+
+	if (room())
+		waiting_.pop_each_if(admissible, start);
+
+	return n;
+}
+
+int socket_engine::wait_time(int timeout_ms) const
+{
+	auto wait_until = [&](clock_type::time_point t)
+	    {
+		// round up, or we spin until the time is due
+		auto us = duration_cast<microseconds>(t -
+		    clock_type::now()).count();
+		auto ms = us > 0 ? (us + 999) / 1000 : 0;
+
+		if (ms > INT_MAX)
+			ms = INT_MAX;
+
+		if (timeout_ms < 0 or ms < timeout_ms)
+			timeout_ms = int(ms);
+	    };
+
+	clock_type::time_point t;
+
+	if (timer_armed_)
+		wait_until(timer_);
+
+	if (not delayed_.empty())
+		wait_until(delayed_.begin()->first);
+
+	// to drop the expired transfers in time
+	if (waiting_.next_deadline(t))
+		wait_until(t);
+
+#if defined(WIN32)
+	// nothing interrupts the wait on Windows, so new submissions
+	// are noticed only when the wait times out
+	if (timeout_ms < 0 or timeout_ms > 10)
+		timeout_ms = 10;
+#endif
+
+	return timeout_ms;
+}
+
+#if defined(__linux__)
+
+void socket_engine::wait_events(int ms)
+{
+	epoll_event evs[64];
+	auto n = epoll_wait(epfd_, evs, 64, ms);
+
+	for (int i = 0; i < n; ++i)
+	{
+		if (evs[i].data.fd == wakefd_)
+		{
+			uint64_t v;
+			auto r = read(wakefd_, &v, sizeof(v));
+			(void)r;
+			continue;
+		}
+
+		int mask = 0;
+
+		if (evs[i].events & EPOLLIN)
+			mask |= CURL_CSELECT_IN;
+		if (evs[i].events & EPOLLOUT)
+			mask |= CURL_CSELECT_OUT;
+		if (evs[i].events & (EPOLLERR | EPOLLHUP))
+			mask |= CURL_CSELECT_ERR;
+
+		act(evs[i].data.fd, mask);
+	}
+}
+
+int socket_engine::on_socket(CURL*, curl_socket_t s, int what, void* p,
+    void*)
+{
+	auto self = static_cast<socket_engine*>(p);
+
+	if (what == CURL_POLL_REMOVE)
+	{
+		epoll_ctl(self->epfd_, EPOLL_CTL_DEL, s, nullptr);
+		return 0;
+	}
+
+	epoll_event ev = {};
+	ev.data.fd = s;
+
+	if (what & CURL_POLL_IN)
+		ev.events |= EPOLLIN;
+	if (what & CURL_POLL_OUT)
+		ev.events |= EPOLLOUT;
+
+	if (epoll_ctl(self->epfd_, EPOLL_CTL_MOD, s, &ev) == -1 and
+	    errno == ENOENT)
+		epoll_ctl(self->epfd_, EPOLL_CTL_ADD, s, &ev);
+
+	return 0;
+}
+
+#else
+
+void socket_engine::wait_events(int ms)
+{
+	std::vector<pollfd> fds;
+	fds.reserve(watched_.size() + 1);
+
+#if !defined(WIN32)
+	pollfd wfd = { wakefd_[0], POLLIN, 0 };
+	fds.push_back(wfd);
+#endif
+
+	for (auto&& w : watched_)
+	{
+		pollfd pfd = { w.first, w.second, 0 };
+		fds.push_back(pfd);
+	}
+
+#if defined(WIN32)
+	if (fds.empty())
+	{
+		Sleep(DWORD(ms));
+		return;
+	}
+
+	auto n = WSAPoll(fds.data(), ULONG(fds.size()), ms);
+#else
+	auto n = ::poll(fds.data(), nfds_t(fds.size()), ms);
+#endif
+
+	for (auto&& pfd : fds)
+	{
+		if (n <= 0)
+			break;
+
+		if (pfd.revents == 0)
+			continue;
+
+		--n;
+
+#if !defined(WIN32)
+		if (pfd.fd == wakefd_[0])
+		{
+			char buf[64];
+			while (read(wakefd_[0], buf, sizeof(buf)) > 0)
+				;
+			continue;
+		}
+#endif
+
+		int mask = 0;
+
+		if (pfd.revents & POLLIN)
+			mask |= CURL_CSELECT_IN;
+		if (pfd.revents & POLLOUT)
+			mask |= CURL_CSELECT_OUT;
+		if (pfd.revents & (POLLERR | POLLHUP))
+			mask |= CURL_CSELECT_ERR;
+
+		act(pfd.fd, mask);
+	}
+}
+
+int socket_engine::on_socket(CURL*, curl_socket_t s, int what, void* p,
+    void*)
+{
+	auto self = static_cast<socket_engine*>(p);
+
+	if (what == CURL_POLL_REMOVE)
+		self->watched_.erase(s);
+	else
+		self->watched_[s] = short(
+		    (what & CURL_POLL_IN ? POLLIN : 0) |
+		    (what & CURL_POLL_OUT ? POLLOUT : 0));
+
+	return 0;
+}
+
+#endif
+
+int socket_engine::on_timer(CURLM*, long timeout_ms, void* p)
+{
+	auto self = static_cast<socket_engine*>(p);
+
+	if (timeout_ms < 0)
+		self->timer_armed_ = false;
+	else
+	{
+		self->timer_armed_ = true;
+		self->timer_ = clock_type::now() + milliseconds(timeout_ms);
+	}
+
+	return 0;
+}
+
+void socket_engine::act(curl_socket_t s, int ev_bitmask)
+{
+	int still_running;
+	auto r = curl_multi_socket_action(multi_, s, ev_bitmask,
+	    &still_running);
+
+	if (r != CURLM_OK and r != CURLM_BAD_SOCKET)
+		abort_running(CURLE_OUT_OF_MEMORY);
+}
+
+size_t socket_engine::finish_done()
+{
+	size_t n = 0;
+	int rc;
+
+	while (auto msg = curl_multi_info_read(multi_, &rc))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		// the message dies with the removal of the handle
+		auto handle = msg->easy_handle;
+		auto r = msg->data.result;
+
+		curl_multi_remove_handle(multi_, handle);
+		curl_easy_setopt(handle, CURLOPT_SHARE, nullptr);
+		end_pool_transfer(handle);
+
+		auto it = running_.find(handle);
+		auto t = std::move(it->second);
+		running_.erase(it);
+
+		observe_flight(t.host, handle, r);
+		end_flight(t.host);
+		t.on_done(r);
+		++n;
+	}
+
+	return n;
+}
+
+void socket_engine::abort_running(CURLcode why)
+{
+	auto ls = std::move(running_);
+	running_.clear();
+
+	for (auto&& t : ls)
+	{
+		curl_multi_remove_handle(multi_, t.first);
+		curl_easy_setopt(t.first, CURLOPT_SHARE, nullptr);
+		end_pool_transfer(t.first);
+		end_flight(t.second.host);
+		t.second.on_done(why);
+	}
+}
+
+}
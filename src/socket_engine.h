@@ -0,0 +1,139 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_SOCKET__ENGINE_H
+#define _HTTPVERBS_SOCKET__ENGINE_H
+
+#include "event_loop.h"
+#include "transfer_scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+namespace httpverbs
+{
+
+// A multi handle driven by curl_multi_socket_action.  libcurl tells
+// which sockets to watch and when to time out, so a wakeup costs
+// O(ready sockets) rather than O(transfers).  Sockets are watched with
+// epoll on Linux and with poll(2) elsewhere.  A submission is held
+// back until its transfer_order::not_before, and past
+// pool_options::max_transfers it waits in a transfer_scheduler, as it
+// does past the process-wide limits kept by flight_limiter.h.
+//
+// submit() and wakeup() may be called from any thread; everything
+// else belongs to the thread which calls poll().
+struct socket_engine
+{
+	socket_engine();
+
+	// drives `pool`, which it neither owns nor closes, so that the
+	// connections stay there for the next user
+	explicit socket_engine(CURLM* pool);
+	~socket_engine();
+
+	void submit(CURL* handle, transfer_order order,
+	    transfer_handler on_done);
+
+	// Aborts the transfer of `handle` submitted with `ticket`, if it
+	// has not finished, with CURLE_ABORTED_BY_CALLBACK.  The ticket
+	// tells it from a later submission of the same handle.
+	void cancel(CURL* handle, unsigned long long ticket);
+	void wakeup();
+
+	// waits up to `timeout_ms` (-1 for no limit) for something to
+	// happen, and returns the number of transfers finished
+	size_t poll(int timeout_ms);
+
+	// transfers submitted but not yet finished
+	size_t running();
+
+	// the thread which last called poll()
+	std::thread::id poller() const
+	{
+		return poller_;
+	}
+
+private:
+	struct running_transfer
+	{
+		transfer_handler on_done;
+		std::string host;
+		unsigned long long ticket;
+	};
+
+	typedef transfer_order::clock_type clock_type;
+
+	static int on_socket(CURL*, curl_socket_t s, int what, void* p,
+	    void* sockp);
+	static int on_timer(CURLM*, long timeout_ms, void* p);
+
+	size_t add_incoming();
+	size_t cancel_one(CURL* handle, unsigned long long ticket);
+	size_t admit();
+	void abort_running(CURLcode why);
+	int wait_time(int timeout_ms) const;
+	void wait_events(int ms);
+	void act(curl_socket_t s, int ev_bitmask);
+	size_t finish_done();
+
+	socket_engine(CURLM* multi, bool owned);
+
+	socket_engine(socket_engine const&);  // = delete
+	socket_engine& operator=(socket_engine const&);  // = delete
+
+	CURLM* multi_;
+	bool owns_multi_;
+	size_t max_running_;
+	std::multimap<clock_type::time_point, pending_transfer> delayed_;
+	transfer_scheduler waiting_;
+	std::unordered_map<CURL*, running_transfer> running_;
+	bool timer_armed_;
+	clock_type::time_point timer_;
+
+#if defined(__linux__)
+	int epfd_;
+	int wakefd_;
+#else
+	std::map<curl_socket_t, short> watched_;
+# if !defined(WIN32)
+	int wakefd_[2];
+# endif
+#endif
+
+	std::atomic<std::thread::id> poller_;
+	std::mutex mu_;
+	std::vector<pending_transfer> incoming_;
+	std::vector<std::pair<CURL*, unsigned long long>> cancels_;
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "socket_tuning.h"
+
+#if defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+namespace httpverbs
+{
+
+template <typename T>
+inline
+void set_option(curl_socket_t fd, int level, int name, T v)
+{
+	// the tuning is best-effort; a socket may not be TCP at all
+	(void)setsockopt(fd, level, name,
+	    reinterpret_cast<char const*>(&v), sizeof(v));
+}
+
+// before connect, so that the buffers decide the window scale
+static
+int tune_socket(void* p, curl_socket_t fd, curlsocktype purpose)
+{
+	auto&& opts = *static_cast<socket_options const*>(p);
+
+	if (purpose != CURLSOCKTYPE_IPCXN)
+		return CURL_SOCKOPT_OK;
+
+	if (opts.receive_buffer > 0)
+		set_option(fd, SOL_SOCKET, SO_RCVBUF, opts.receive_buffer);
+
+	if (opts.send_buffer > 0)
+		set_option(fd, SOL_SOCKET, SO_SNDBUF, opts.send_buffer);
+
+#if defined(SO_BUSY_POLL)
+	if (opts.busy_poll.count() > 0)
+		set_option(fd, SOL_SOCKET, SO_BUSY_POLL,
+		    int(opts.busy_poll.count()));
+#endif
+
+	return CURL_SOCKOPT_OK;
+}
+
+void tune_sockets(CURL* handle, socket_options const& opts)
+{
+	curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, long(opts.no_delay));
+
+#if LIBCURL_VERSION_NUM >= 0x071900
+	curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, long(opts.keepalive));
+
+	if (opts.keepalive_idle.count() != 0)
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE,
+		    long(opts.keepalive_idle.count()));
+
+	if (opts.keepalive_interval.count() != 0)
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL,
+		    long(opts.keepalive_interval.count()));
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x073b00
+	if (opts.happy_eyeballs.count() != 0)
+		curl_easy_setopt(handle, CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS,
+		    long(opts.happy_eyeballs.count()));
+#endif
+
+	if (opts.receive_buffer > 0 or opts.send_buffer > 0 or
+	    opts.busy_poll.count() > 0)
+	{
+		curl_easy_setopt(handle, CURLOPT_SOCKOPTFUNCTION, tune_socket);
+		curl_easy_setopt(handle, CURLOPT_SOCKOPTDATA, &opts);
+	}
+}
+
+}
@@ -0,0 +1,204 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTPVERBS_TRANSFER__SCHEDULER_H
+#define _HTTPVERBS_TRANSFER__SCHEDULER_H
+
+#include "event_loop.h"
+
+#include <map>
+#include <set>
+#include <utility>
+
+namespace httpverbs
+{
+
+struct pending_transfer
+{
+	CURL* handle;
+	transfer_order order;
+	transfer_handler on_done;
+	transfer_order::clock_type::time_point submitted;
+};
+
+// The transfers waiting for an event loop to admit them, most urgent
+// first: by priority, then by deadline, then in submission order.  A
+// transfer whose deadline passes while waiting fails without ever
+// taking a connection.
+struct transfer_scheduler
+{
+	typedef transfer_order::clock_type clock_type;
+
+	transfer_scheduler() : seq_(0)
+	{}
+
+	bool empty() const
+	{
+		return queue_.empty();
+	}
+
+	size_t size() const
+	{
+		return queue_.size();
+	}
+
+	void push(pending_transfer t);
+
+	// removes the most urgent transfer for which `admissible` holds,
+	// if any
+	template <typename Pred>
+	bool pop_if(pending_transfer& t, Pred admissible);
+
+	// Removes the transfers for which `admissible` holds, most urgent
+	// first, and hands each to `start` until it returns false.  The
+	// queue is walked once, so the transfers held back are not looked
+	// at again for each one admitted.
+	template <typename Pred, typename Func>
+	void pop_each_if(Pred admissible, Func start);
+
+	// hands the transfers due by `now` to `expire`, and returns how
+	// many
+	template <typename Func>
+	size_t drop_expired(clock_type::time_point now, Func expire);
+
+	// false if no waiting transfer has a deadline
+	bool next_deadline(clock_type::time_point& t) const;
+
+	template <typename Func>
+	void clear(Func abort);
+
+private:
+	struct key
+	{
+		int priority;
+		clock_type::time_point deadline;
+		unsigned long long seq;
+	};
+
+	struct by_urgency
+	{
+		bool operator()(key const& a, key const& b) const
+		{
+			if (a.priority != b.priority)
+				return a.priority > b.priority;
+
+			if (a.deadline != b.deadline)
+				return a.deadline < b.deadline;
+
+			return a.seq < b.seq;
+		}
+	};
+
+	struct by_deadline
+	{
+		bool operator()(key const& a, key const& b) const
+		{
+			if (a.deadline != b.deadline)
+				return a.deadline < b.deadline;
+
+			return a.seq < b.seq;
+		}
+	};
+
+	typedef std::map<key, pending_transfer, by_urgency> queue_type;
+
+	void erase(queue_type::iterator it);
+
+	queue_type queue_;
+	std::set<key, by_deadline> deadlines_;
+	unsigned long long seq_;
+};
+
+template <typename Pred>
+bool transfer_scheduler::pop_if(pending_transfer& t, Pred admissible)
+{
+	for (auto it = queue_.begin(); it != queue_.end(); ++it)
+	{
+		if (admissible(it->second))
+		{
+			t = std::move(it->second);
+			erase(it);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template <typename Pred, typename Func>
+void transfer_scheduler::pop_each_if(Pred admissible, Func start)
+{
+	auto it = queue_.begin();
+
+	while (it != queue_.end())
+	{
+		if (not admissible(it->second))
+		{
+			++it;
+			continue;
+		}
+
+		auto t = std::move(it->second);
+		erase(it++);
+
+		if (not start(t))
+			break;
+	}
+}
+
+template <typename Func>
+size_t transfer_scheduler::drop_expired(clock_type::time_point now,
+    Func expire)
+{
+	size_t n = 0;
+
+	while (not deadlines_.empty() and deadlines_.begin()->deadline <= now)
+	{
+		auto it = queue_.find(*deadlines_.begin());
+		auto t = std::move(it->second);
+		erase(it);
+
+		expire(t);
+		++n;
+	}
+
+	return n;
+}
+
+template <typename Func>
+void transfer_scheduler::clear(Func abort)
+{
+	auto ls = std::move(queue_);
+	queue_.clear();
+	deadlines_.clear();
+
+	for (auto&& t : ls)
+		abort(t.second);
+}
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2014 Zhihao Yuan.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <httpverbs/enable_library.h>
+#include <httpverbs/request.h>
+
+#include "warm_up.h"
+#include "config.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace httpverbs
+{
+
+#if defined(SHARED_CACHE) || !defined(PER_THREAD_CACHE)
+#define SHARED_BLOCKING_POOLS
+#endif
+
+static
+size_t warm(std::vector<std::string> const& urls,
+    long connections_per_host, std::chrono::milliseconds timeout,
+    bool blocking)
+{
+	std::vector<request> async, reqs;
+	std::vector<std::future<response>> fs;
+
+	for (auto&& url : urls)
+		for (long i = 0; i < connections_per_host; ++i)
+		{
+			async.push_back(request("HEAD", url));
+			async.back().ignore_response_body().timeout(timeout);
+
+			if (blocking)
+			{
+				reqs.push_back(request("HEAD", url));
+				reqs.back().ignore_response_body()
+				    .timeout(timeout);
+			}
+		}
+
+	// all at once, so that none waits for another's connection
+	for (auto&& req : async)
+	{
+		try
+		{
+			fs.push_back(req.perform_async());
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+
+	// meanwhile, in the blocking pool of this thread
+	if (not reqs.empty())
+	{
+		try
+		{
+			perform_all(reqs);
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+
+	size_t n = 0;
+
+	for (auto&& f : fs)
+	{
+		try
+		{
+			f.get();
+			++n;
+		}
+		catch (std::exception&)
+		{
+		}
+	}
+
+	return n;
+}
+
+size_t warm_up(std::vector<std::string> const& urls,
+    long connections_per_host, std::chrono::milliseconds timeout)
+{
+	return warm(urls, connections_per_host, timeout, true);
+}
+
+namespace
+{
+
+struct rewarmer
+{
+	explicit rewarmer(pool_options const& opts) :
+		urls_(opts.warm_urls),
+		n_(opts.warm_connections),
+		timeout_(opts.warm_timeout),
+		interval_(opts.rewarm_interval),
+		stopping_(false),
+		thr_(&rewarmer::run, this)
+	{}
+
+	~rewarmer()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu_);
+			stopping_ = true;
+		}
+
+		cv_.notify_one();
+		thr_.join();
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+
+		while (not cv_.wait_for(lk, interval_, [&]
+		    {
+			return stopping_;
+		    }))
+		{
+			lk.unlock();
+#if defined(SHARED_BLOCKING_POOLS)
+			warm(urls_, n_, timeout_, true);
+#else
+			// a pool of this thread's own would serve nobody
+			warm(urls_, n_, timeout_, false);
+#endif
+			lk.lock();
+		}
+	}
+
+	std::vector<std::string> urls_;
+	long n_;
+	std::chrono::milliseconds timeout_;
+	std::chrono::seconds interval_;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	bool stopping_;
+	std::thread thr_;
+};
+
+rewarmer* the_rewarmer;
+
+}
+
+void start_rewarming(pool_options const& opts)
+{
+	if (opts.warm_urls.empty() or opts.rewarm_interval.count() == 0)
+		return;
+
+	delete the_rewarmer;
+	the_rewarmer = new rewarmer(opts);
+}
+
+void stop_rewarming()
+{
+	delete the_rewarmer;
+	the_rewarmer = nullptr;
+}
+
+}
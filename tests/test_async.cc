@@ -0,0 +1,299 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+
+httpverbs::enable_library _;
+std::string host = "http://localhost:8080/";
+
+using namespace httpverbs::keywords;
+
+TEST_CASE("asynchronous queries", "[network]")
+{
+	auto k = host + "async";
+
+	SECTION("resolve to a response")
+	{
+		auto req = httpverbs::request("PUT", k);
+		req.content = "Flame and fire";
+
+		auto fut = req.perform_async();
+
+		REQUIRE(fut.get().status_code == 201);
+
+		req = httpverbs::request("GET", k);
+		auto resp = req.perform_async().get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.headers.get("content-type"));
+		REQUIRE(resp.content == "Flame and fire");
+	}
+
+	SECTION("many outstanding")
+	{
+		std::vector<httpverbs::request> reqs;
+		std::vector<std::future<httpverbs::response>> futs;
+
+		for (int i = 0; i < 10; ++i)
+			reqs.push_back(httpverbs::request("HEAD", k));
+
+		for (auto&& req : reqs)
+			futs.push_back(req.perform_async());
+
+		for (auto&& fut : futs)
+			REQUIRE(fut.get().status_code == 200);
+	}
+
+	SECTION("send and receive with callbacks")
+	{
+		auto req = httpverbs::request("ECHO", host);
+		char s[] = "Burning bright";
+		std::string out;
+
+		auto resp = req.perform_async(
+		    sizeof(s) - 1,
+		    [&](char* d, size_t n) -> size_t
+		    {
+			memcpy(d, s, sizeof(s) - 1);
+
+			return sizeof(s) - 1;
+		    },
+		    [&](char* d, size_t n) -> size_t
+		    {
+			out.append(d, n);
+
+			return n;
+		    }).get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(out == s);
+	}
+
+	SECTION("transport errors")
+	{
+		auto req = httpverbs::request("GET", "http://localhost:1/");
+		auto fut = req.perform_async();
+
+		REQUIRE_THROWS_AS(fut.get(), httpverbs::bad_response&);
+	}
+}
+
+TEST_CASE("completion callbacks", "[network]")
+{
+	auto req = httpverbs::request("ECHO", host);
+	req.content = "What immortal hand or eye";
+
+	std::mutex mu;
+	std::condition_variable cv;
+	std::vector<std::function<void()>> jobs;
+	int code = 0;
+	std::string content;
+	std::thread::id tid;
+
+	auto handler = [&](std::exception_ptr ep, httpverbs::response resp)
+	    {
+		std::lock_guard<std::mutex> lk(mu);
+		if (not ep)
+		{
+			code = resp.status_code;
+			content = resp.content;
+		}
+		tid = std::this_thread::get_id();
+		cv.notify_one();
+	    };
+
+	SECTION("in the I/O thread")
+	{
+		req.perform(on_complete(handler));
+
+		std::unique_lock<std::mutex> lk(mu);
+		cv.wait(lk, [&] { return code != 0; });
+
+		REQUIRE(code == 200);
+		REQUIRE(content == req.content);
+		REQUIRE(tid != std::this_thread::get_id());
+	}
+
+	SECTION("on an executor")
+	{
+		req.perform(on_complete(handler,
+		    [&](std::function<void()> job)
+		    {
+			std::lock_guard<std::mutex> lk(mu);
+			jobs.push_back(std::move(job));
+			cv.notify_one();
+		    }));
+
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lk(mu);
+			cv.wait(lk, [&] { return not jobs.empty(); });
+			job = std::move(jobs.front());
+		}
+
+		job();
+
+		REQUIRE(code == 200);
+		REQUIRE(content == req.content);
+		REQUIRE(tid == std::this_thread::get_id());
+	}
+}
+
+TEST_CASE("batch of queries", "[network]")
+{
+	std::vector<httpverbs::request> reqs;
+
+	for (int i = 0; i < 5; ++i)
+	{
+		reqs.push_back(httpverbs::request("ECHO", host));
+		reqs.back().content = std::string(i + 1, 'x');
+	}
+
+	reqs.push_back(httpverbs::request("GET", host + "nonexistent"));
+
+	auto resps = httpverbs::perform_all(reqs);
+
+	REQUIRE(resps.size() == reqs.size());
+
+	for (int i = 0; i < 5; ++i)
+	{
+		REQUIRE(resps[i].status_code == 200);
+		REQUIRE(resps[i].content == reqs[i].content);
+	}
+
+	REQUIRE(resps.back().status_code == 404);
+
+	SECTION("transport errors")
+	{
+		reqs.push_back(httpverbs::request("GET", "http://localhost:1/"));
+
+		REQUIRE_THROWS_AS(httpverbs::perform_all(reqs.begin(),
+		    reqs.end()), httpverbs::bad_response&);
+	}
+}
+
+TEST_CASE("queries from many threads", "[network]")
+{
+	std::vector<std::thread> ths;
+	std::vector<int> codes(4 * 5);
+
+	for (int i = 0; i < 4; ++i)
+		ths.push_back(std::thread([&, i]
+		    {
+			for (int j = 0; j < 5; ++j)
+			{
+				auto req = httpverbs::request("OPTIONS", host);
+				auto r1 = req.perform();
+				auto r2 = req.perform_async().get();
+
+				codes[i * 5 + j] = r1 == r2 ?
+				    r1.status_code : 0;
+			}
+		    }));
+
+	for (auto&& th : ths)
+		th.join();
+
+	for (auto code : codes)
+		REQUIRE(code == 200);
+}
+
+TEST_CASE("caller-driven engine", "[network]")
+{
+	httpverbs::engine eng;
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 5; ++i)
+	{
+		reqs.push_back(httpverbs::request("ECHO", host));
+		reqs.back().content = std::string(i + 1, 'x');
+	}
+
+	for (auto&& req : reqs)
+		futs.push_back(eng.start(req));
+
+	REQUIRE(eng.running() == 5);
+
+	size_t finished = 0;
+
+	while (eng.running() != 0)
+		finished += eng.poll(1000);
+
+	REQUIRE(finished == 5);
+
+	for (int i = 0; i < 5; ++i)
+	{
+		auto resp = futs[i].get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == reqs[i].content);
+	}
+
+	SECTION("transport errors")
+	{
+		auto req = httpverbs::request("GET", "http://localhost:1/");
+		auto fut = eng.start(req);
+
+		while (eng.running() != 0)
+			eng.poll(-1);
+
+		REQUIRE_THROWS_AS(fut.get(), httpverbs::bad_response&);
+	}
+}
+
+TEST_CASE("admission by priority and deadline", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_transfers = 1;
+
+	httpverbs::enable_library e(opts);
+	httpverbs::engine eng;
+
+	auto now = std::chrono::steady_clock::now();
+	std::vector<httpverbs::request> reqs;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		reqs.push_back(httpverbs::request("ECHO", host));
+		reqs.back().content = std::to_string(i);
+	}
+
+	reqs[0].priority(-1);
+	reqs[1].deadline(now + std::chrono::hours(2));
+	reqs[2].deadline(now + std::chrono::hours(1));
+	reqs[3].priority(1);
+
+	auto late = httpverbs::request("OPTIONS", host);
+	late.deadline(now);
+
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (auto&& req : reqs)
+		futs.push_back(eng.start(req));
+
+	auto late_fut = eng.start(late);
+	std::vector<std::string> order;
+
+	while (eng.running() != 0)
+	{
+		eng.poll(1000);
+
+		for (auto&& fut : futs)
+			if (fut.valid() and fut.wait_for(std::chrono::seconds(0))
+			    == std::future_status::ready)
+				order.push_back(fut.get().content);
+	}
+
+	REQUIRE(order == (std::vector<std::string>{ "3", "2", "1", "0" }));
+	REQUIRE_THROWS_AS(late_fut.get(), httpverbs::bad_response&);
+	REQUIRE_THROWS_AS(late.perform(), httpverbs::bad_response&);
+}
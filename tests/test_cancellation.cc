@@ -0,0 +1,112 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+
+httpverbs::enable_library _;
+
+TEST_CASE("cancellation", "[network]")
+{
+	httpverbs::enable_library e;
+	httpverbs::cancellation_token tk;
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread th([=]() mutable
+	    {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		tk.cancel();
+	    });
+
+	SECTION("blocking")
+	{
+		auto req = httpverbs::request("GET",
+		    "http://localhost:8080/stall-once/c1");
+		req.cancel_on(tk);
+
+		REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+	}
+
+	SECTION("asynchronous")
+	{
+		std::vector<httpverbs::request> reqs;
+		std::vector<std::future<httpverbs::response>> fs;
+
+		for (auto path : { "c2", "c3", "c4" })
+			reqs.push_back(httpverbs::request("GET",
+			    std::string("http://localhost:8080/stall-once/") +
+			    path));
+
+		for (auto&& req : reqs)
+			fs.push_back(req.cancel_on(tk).perform_async());
+
+		for (auto&& f : fs)
+			REQUIRE_THROWS_AS(f.get(), httpverbs::bad_response&);
+	}
+
+	th.join();
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(tk.cancelled());
+	REQUIRE(elapsed < std::chrono::seconds(1));
+
+	// too late to start
+	auto req = httpverbs::request("GET", "http://localhost:8080/");
+	req.cancel_on(tk);
+
+	REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+	REQUIRE_THROWS_AS(req.perform_async(), httpverbs::bad_response&);
+}
+
+TEST_CASE("cancellation waiting for room", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_in_flight = 1;
+	opts.max_queued = 0;
+
+	httpverbs::enable_library e(opts);
+	httpverbs::cancellation_token tk;
+
+	// takes the only room for 2 seconds
+	auto slow = httpverbs::request("GET",
+	    "http://localhost:8080/stall-once/c5");
+	auto slow_fut = slow.perform_async();
+
+	auto req = httpverbs::request("PUT",
+	    "http://localhost:8080/never-put");
+	req.content = "Could frame thy fearful symmetry?";
+	req.cancel_on(tk);
+
+	// blocks for room until cancelled
+	bool thrown = false;
+	std::thread th([&]
+	    {
+		try
+		{
+			req.perform_async();
+		}
+		catch (httpverbs::bad_response&)
+		{
+			thrown = true;
+		}
+	    });
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	auto start = std::chrono::steady_clock::now();
+	tk.cancel();
+	th.join();
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(thrown);
+	REQUIRE(elapsed < std::chrono::milliseconds(500));
+	REQUIRE(httpverbs::get("http://localhost:8080/never-put")
+	    .status_code == 404);
+	REQUIRE(slow_fut.get().content == "slow");
+}
@@ -0,0 +1,139 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+httpverbs::enable_library _;
+
+// Sums up the pools of the blocking transfers, whichever the kind by
+// the build options, or those of the event loops.
+static
+httpverbs::connection_stats to_localhost(bool blocking)
+{
+	httpverbs::connection_stats total = {};
+
+	for (auto&& st : httpverbs::pool_connection_stats())
+	{
+		bool loop = st.kind == httpverbs::connection_stats::per_loop;
+
+		if (loop == blocking or st.host != "localhost")
+			continue;
+
+		total.open += st.open;
+		total.idle += st.idle;
+		total.created += st.created;
+		total.reused += st.reused;
+		total.tls_handshakes += st.tls_handshakes;
+		total.tls_resumed += st.tls_resumed;
+	}
+
+	return total;
+}
+
+TEST_CASE("sockets untracked", "[network]")
+{
+	httpverbs::enable_library e;
+
+	REQUIRE(httpverbs::get("http://127.0.0.1:8080/keep-alive/s3")
+	    .status_code == 404);
+
+	// counted without the socket hooks, but not the open one
+	httpverbs::connection_stats total = {};
+
+	for (auto&& st : httpverbs::pool_connection_stats())
+	{
+		if (st.host != "127.0.0.1")
+			continue;
+
+		total.open += st.open;
+		total.created += st.created;
+	}
+
+	REQUIRE(total.created == 1u);
+	REQUIRE(total.open == 0u);
+}
+
+TEST_CASE("connection stats", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.track_sockets = true;
+
+	httpverbs::enable_library e(opts);
+
+	// the test server closes every connection after one response
+	SECTION("closed")
+	{
+		httpverbs::get("http://127.0.0.1:8080/");
+		httpverbs::get("http://localhost:8080/");
+		httpverbs::get("http://localhost:8080/");
+
+		auto st = to_localhost(true);
+		REQUIRE(st.created == 2u);
+		REQUIRE(st.reused == 0u);
+		REQUIRE(st.open == 0u);
+		REQUIRE(st.idle == 0u);
+		REQUIRE(st.tls_handshakes == 0u);
+
+		httpverbs::request("GET", "http://localhost:8080/")
+		    .perform_async().get();
+
+		st = to_localhost(false);
+		REQUIRE(st.created == 1u);
+		REQUIRE(st.open == 0u);
+	}
+
+	// but not those to /keep-alive/
+	SECTION("kept alive")
+	{
+		auto req = httpverbs::request("PUT",
+		    "http://localhost:8080/keep-alive/s1");
+		req.content = "What the hand, dare seize the fire?";
+
+		REQUIRE(req.perform().status_code == 201);
+		REQUIRE(httpverbs::get("http://localhost:8080/keep-alive/s1")
+		    .content == req.content);
+
+		auto st = to_localhost(true);
+		REQUIRE(st.created == 1u);
+		REQUIRE(st.reused == 1u);
+		REQUIRE(st.open == 1u);
+		REQUIRE(st.idle == 1u);
+
+		auto get = httpverbs::request("GET",
+		    "http://localhost:8080/keep-alive/s1");
+
+		REQUIRE(get.perform_async().get().content == req.content);
+		REQUIRE(get.perform_async().get().content == req.content);
+
+		st = to_localhost(false);
+		REQUIRE(st.created == 1u);
+		REQUIRE(st.reused == 1u);
+		REQUIRE(st.idle == 1u);
+	}
+
+	SECTION("over TLS")
+	{
+		httpverbs::enable_library tls("tests/test_server.crt", opts);
+
+		auto url = std::string("https://localhost:8443/keep-alive/s2");
+
+		REQUIRE(httpverbs::get(url).status_code == 404);
+		REQUIRE(httpverbs::get(url).status_code == 404);
+
+		auto st = to_localhost(true);
+		REQUIRE(st.created == 1u);
+		REQUIRE(st.reused == 1u);
+		REQUIRE(st.tls_handshakes == 1u);
+
+		// the event loop's pool resumes the session
+		auto req = httpverbs::request("GET", url);
+
+		REQUIRE(req.perform_async().get().status_code == 404);
+
+		st = to_localhost(false);
+		REQUIRE(st.created == 1u);
+		REQUIRE(st.tls_handshakes == 1u);
+		REQUIRE(st.tls_resumed == 1u);
+	}
+}
@@ -0,0 +1,133 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+#include <httpverbs/stream.h>
+
+#if defined(__cpp_impl_coroutine)
+
+#include <httpverbs/coroutine.h>
+
+#include <sstream>
+#include <vector>
+
+httpverbs::enable_library _;
+std::string host = "http://localhost:8080/";
+
+using namespace httpverbs::keywords;
+
+struct detached
+{
+	struct promise_type
+	{
+		detached get_return_object()
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void()
+		{}
+
+		void unhandled_exception()
+		{
+			std::terminate();
+		}
+	};
+};
+
+template <typename Awaitable>
+detached forward_to(std::promise<httpverbs::response>& pr, Awaitable aw)
+{
+	try
+	{
+		pr.set_value(co_await std::move(aw));
+	}
+	catch (...)
+	{
+		pr.set_exception(std::current_exception());
+	}
+}
+
+TEST_CASE("coroutine queries", "[network]")
+{
+	std::promise<httpverbs::response> pr;
+	auto fut = pr.get_future();
+
+	SECTION("to a string")
+	{
+		auto req = httpverbs::request("ECHO", host);
+		req.content = "Tyger Tyger";
+
+		forward_to(pr, req.perform_co());
+		auto resp = fut.get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == req.content);
+	}
+
+	SECTION("to a callback")
+	{
+		auto req = httpverbs::request("ECHO", host);
+		std::string out;
+
+		forward_to(pr, req.perform_co(data_from("burning bright"),
+		    [&](char* d, size_t n) -> size_t
+		    {
+			out.append(d, n);
+
+			return n;
+		    }));
+
+		REQUIRE(fut.get().status_code == 200);
+		REQUIRE(out == "burning bright");
+	}
+
+	SECTION("to a stream")
+	{
+		auto req = httpverbs::request("ECHO", host);
+		req.content = "In the forests of the night";
+		std::ostringstream out;
+
+		forward_to(pr, req.perform_co(to_stream(out)));
+
+		REQUIRE(fut.get().status_code == 200);
+		REQUIRE(out.str() == req.content);
+	}
+
+	SECTION("many outstanding")
+	{
+		std::vector<httpverbs::request> reqs;
+		std::vector<std::promise<httpverbs::response>> prs(10);
+
+		for (int i = 0; i < 10; ++i)
+			reqs.push_back(httpverbs::request("OPTIONS", host));
+
+		for (int i = 0; i < 10; ++i)
+			forward_to(prs[i], reqs[i].perform_co());
+
+		for (auto&& p : prs)
+			REQUIRE(p.get_future().get().status_code == 200);
+	}
+
+	SECTION("transport errors")
+	{
+		auto req = httpverbs::request("GET", "http://localhost:1/");
+
+		forward_to(pr, req.perform_co());
+
+		REQUIRE_THROWS_AS(fut.get(), httpverbs::bad_response&);
+	}
+}
+
+#endif
@@ -8,7 +8,12 @@
 #include <iomanip>
 #include <cstring>
 
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 106600
+#include <boost/uuid/detail/sha1.hpp>
+#else
 #include <boost/uuid/sha1.hpp>
+#endif
 
 static auto e = std::mt19937(std::random_device()());
 
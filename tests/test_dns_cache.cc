@@ -0,0 +1,83 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+httpverbs::enable_library _;
+
+TEST_CASE("pinned addresses", "[network]")
+{
+	auto fn = std::string("test_dns_cache.dns");
+
+	{
+		std::ofstream out(fn);
+		out << "pinned.test:8080:127.0.0.1\n";
+	}
+
+	httpverbs::pool_options opts;
+	opts.resolve_hosts.push_back("localhost:8080");
+	opts.resolve_hosts.push_back("pinned.test:8080");
+	opts.resolve_interval = std::chrono::seconds(0);
+	opts.resolve_file = fn;
+
+	{
+		httpverbs::enable_library e(opts);
+
+		// no name server knows it
+		REQUIRE_NOTHROW(httpverbs::get("http://pinned.test:8080/"));
+		REQUIRE_NOTHROW(httpverbs::get("http://localhost:8080/"));
+	}
+
+	std::ifstream in(fn);
+	std::string line;
+	std::vector<std::string> ls;
+
+	while (std::getline(in, line))
+		ls.push_back(line);
+
+	REQUIRE(ls.size() == 2u);
+	REQUIRE(ls[1] == "pinned.test:8080:127.0.0.1");
+
+	std::remove(fn.data());
+}
+
+TEST_CASE("pinned hosts in any case", "[network]")
+{
+	auto fn = std::string("test_dns_cache.dns");
+
+	{
+		std::ofstream out(fn);
+		out << "pinned.test:8080:127.0.0.1\n";
+		out << "dropped.test:8080:127.0.0.1\n";
+	}
+
+	httpverbs::pool_options opts;
+	opts.resolve_hosts.push_back("Pinned.Test:8080");
+	opts.resolve_interval = std::chrono::seconds(0);
+	opts.resolve_file = fn;
+
+	{
+		httpverbs::enable_library e(opts);
+
+		REQUIRE_NOTHROW(httpverbs::get("http://pinned.test:8080/"));
+		REQUIRE_NOTHROW(httpverbs::get("http://PINNED.test:8080/"));
+	}
+
+	// no longer listed, so not saved again
+	std::ifstream in(fn);
+	std::string line;
+	std::vector<std::string> ls;
+
+	while (std::getline(in, line))
+		ls.push_back(line);
+
+	REQUIRE(ls.size() == 1u);
+	REQUIRE(ls[0] == "pinned.test:8080:127.0.0.1");
+
+	std::remove(fn.data());
+}
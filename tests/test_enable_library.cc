@@ -2,6 +2,11 @@
 #include "catch.hpp"
 
 #include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <thread>
+#include <chrono>
 
 httpverbs::enable_library _;
 
@@ -19,3 +24,63 @@ TEST_CASE("customized CA bundle path", "[network]")
 	REQUIRE_NOTHROW(httpverbs::get("https://httpbin.org/get"));
 #endif
 }
+
+TEST_CASE("customized connection pool", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_connections = 2;
+	opts.max_host_connections = 1;
+	opts.max_total_connections = 1;
+
+	httpverbs::enable_library e(opts);
+
+	// the options apply to the pools created afterwards
+	std::vector<httpverbs::response> resps;
+	std::thread th([&]
+	    {
+		std::vector<httpverbs::request> reqs;
+
+		for (int i = 0; i < 4; ++i)
+			reqs.push_back(httpverbs::request("OPTIONS",
+			    "http://localhost:8080/"));
+
+		resps = httpverbs::perform_all(reqs);
+	    });
+
+	th.join();
+
+	REQUIRE(resps.size() == 4);
+
+	for (auto&& resp : resps)
+		REQUIRE(resp.status_code == 200);
+}
+
+TEST_CASE("nested enable_library", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.host_rate = httpverbs::rate_limit(20, 2);
+
+	httpverbs::enable_library e(opts);
+
+	// two at once, then one every 50ms
+	auto paced = [&]
+	    {
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < 6; ++i)
+			httpverbs::request("OPTIONS",
+			    "http://localhost:8080/").perform();
+
+		return std::chrono::steady_clock::now() - start >=
+		    std::chrono::milliseconds(4 * 50);
+	    };
+
+	{
+		httpverbs::enable_library inner;
+
+		REQUIRE_FALSE(paced());
+	}
+
+	// the outer options are back
+	REQUIRE(paced());
+}
@@ -0,0 +1,39 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <future>
+
+httpverbs::enable_library _;
+
+TEST_CASE("sharded event loops", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.event_loops = 4;
+	opts.pin_event_loops = true;
+
+	SECTION("balanced by host") {}
+
+	SECTION("balanced by outstanding transfers")
+	{
+		opts.loop_balance = httpverbs::pool_options::least_outstanding;
+	}
+
+	httpverbs::enable_library e(opts);
+
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 12; ++i)
+		reqs.push_back(httpverbs::request("OPTIONS",
+		    i % 2 ? "http://localhost:8080/" : "http://127.0.0.1:8080/"));
+
+	for (auto&& req : reqs)
+		futs.push_back(req.perform_async());
+
+	for (auto&& fut : futs)
+		REQUIRE(fut.get().status_code == 200);
+}
@@ -0,0 +1,108 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <future>
+
+httpverbs::enable_library _;
+
+TEST_CASE("in-flight limits", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_in_flight = 2;
+	opts.max_host_in_flight = 1;
+
+	SECTION("waiting for room")
+	{
+		opts.max_queued = 1;
+	}
+
+	SECTION("unbounded queue") {}
+
+	httpverbs::enable_library e(opts);
+
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 8; ++i)
+		reqs.push_back(httpverbs::request("OPTIONS",
+		    i % 2 ? "http://localhost:8080/" : "http://127.0.0.1:8080/"));
+
+	for (auto&& req : reqs)
+		futs.push_back(req.perform_async());
+
+	for (auto&& fut : futs)
+		REQUIRE(fut.get().status_code == 200);
+
+	for (auto&& resp : httpverbs::perform_all(reqs))
+		REQUIRE(resp.status_code == 200);
+
+	auto st = httpverbs::transfer_queue_stats();
+
+	REQUIRE(st.started == 16u);
+	REQUIRE(st.in_flight == 0u);
+	REQUIRE(st.queued == 0u);
+	REQUIRE(st.max_wait >= std::chrono::nanoseconds(0));
+}
+
+TEST_CASE("full transfer queue", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_in_flight = 1;
+	opts.max_queued = 0;
+	opts.when_full = httpverbs::pool_options::fail_at_once;
+
+	httpverbs::enable_library e(opts);
+
+	auto req = httpverbs::request("PUT", "http://localhost:8080/full");
+	req.content = "Tyger Tyger, burning bright";
+
+	auto fut = req.perform_async();
+	auto req2 = httpverbs::request("OPTIONS", "http://localhost:8080/");
+
+	REQUIRE_THROWS_AS(req2.perform_async(), httpverbs::would_block&);
+	REQUIRE(fut.get().status_code == 201);
+	REQUIRE(req2.perform_async().get().status_code == 200);
+}
+
+TEST_CASE("adaptive host limits", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_host_in_flight = 6;
+	opts.adaptive_host_in_flight = true;
+
+	httpverbs::enable_library e(opts);
+
+	REQUIRE(httpverbs::host_in_flight_limit("localhost") == 4);
+
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 16; ++i)
+		reqs.push_back(httpverbs::request("OPTIONS",
+		    "http://localhost:8080/"));
+
+	for (auto&& req : reqs)
+		futs.push_back(req.perform_async());
+
+	for (auto&& fut : futs)
+		REQUIRE(fut.get().status_code == 200);
+
+	auto n = httpverbs::host_in_flight_limit("localhost");
+
+	REQUIRE(n >= 1);
+	REQUIRE(n <= 6);
+
+	// nothing listens there; each refusal halves the limit
+	auto req = httpverbs::request("OPTIONS", "http://127.0.0.1:1/");
+
+	REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+	REQUIRE(httpverbs::host_in_flight_limit("127.0.0.1") == 2);
+
+	REQUIRE_THROWS_AS(req.perform_async().get(), httpverbs::bad_response&);
+	REQUIRE_THROWS_AS(req.perform_async().get(), httpverbs::bad_response&);
+	REQUIRE(httpverbs::host_in_flight_limit("127.0.0.1") == 1);
+}
@@ -0,0 +1,91 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <chrono>
+
+httpverbs::enable_library _;
+
+TEST_CASE("hedged requests", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.hedge_idempotent = true;
+	opts.hedge_delay = std::chrono::milliseconds(100);
+
+	httpverbs::enable_library e(opts);
+
+	auto start = std::chrono::steady_clock::now();
+	httpverbs::response resp;
+
+	SECTION("blocking")
+	{
+		resp = httpverbs::get("http://localhost:8080/stall-once/a");
+	}
+
+	SECTION("asynchronous")
+	{
+		auto req = httpverbs::request("GET",
+		    "http://localhost:8080/stall-once/b");
+		resp = req.perform_async().get();
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	// the duplicate, sent 100ms in, wins
+	REQUIRE(resp.status_code == 200);
+	REQUIRE(resp.content == "fast");
+	REQUIRE(elapsed < std::chrono::seconds(1));
+
+	// a PUT is never hedged
+	auto req = httpverbs::request("PUT", "http://localhost:8080/hedged");
+	req.content = "Did he smile his work to see?";
+
+	REQUIRE(req.perform().status_code == 201);
+	REQUIRE(httpverbs::get("http://localhost:8080/hedged").content ==
+	    req.content);
+}
+
+TEST_CASE("hedges within the rate limits", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.hedge_idempotent = true;
+	opts.hedge_delay = std::chrono::milliseconds(100);
+	opts.host_rate = httpverbs::rate_limit(0.1, 1);
+	opts.timeout = std::chrono::seconds(5);
+
+	httpverbs::enable_library e(opts);
+
+	// the first takes the only token, so the duplicate is not sent
+	auto resp = httpverbs::get("http://localhost:8080/stall-once/r");
+
+	REQUIRE(resp.status_code == 200);
+	REQUIRE(resp.content == "slow");
+}
+
+TEST_CASE("hedges by the latencies", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.hedge_idempotent = true;
+	opts.hedge_budget = 0.1;
+
+	httpverbs::enable_library e(opts);
+
+	// not hedged until there is a window to take the delay from
+	for (int i = 0; i < 20; ++i)
+		REQUIRE(httpverbs::get("http://localhost:8080/keep-alive/p")
+		    .status_code == 404);
+
+	auto start = std::chrono::steady_clock::now();
+	auto resp = httpverbs::get("http://localhost:8080/stall-once/p1");
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(resp.content == "fast");
+	REQUIRE(elapsed < std::chrono::seconds(1));
+
+	// that was the host's hedge for the next ten requests
+	resp = httpverbs::get("http://localhost:8080/stall-once/p2");
+
+	REQUIRE(resp.content == "slow");
+}
@@ -0,0 +1,140 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+#include <boost/optional/optional_io.hpp>
+
+#include <vector>
+
+httpverbs::enable_library _;
+std::string host = "http://localhost:8080/";
+
+TEST_CASE("HTTP/2 opt-in", "[network]")
+{
+	SECTION("cleartext stays on HTTP/1.1 without prior knowledge")
+	{
+		auto req = httpverbs::request("OPTIONS", host);
+		auto resp = req.use_http2().stream_weight(32).perform();
+
+		REQUIRE(resp.status_code == 200);
+	}
+
+	SECTION("prior knowledge does not fall back")
+	{
+		auto req = httpverbs::request("OPTIONS", host);
+
+		REQUIRE_THROWS_AS(req.use_h2c().perform(),
+		    httpverbs::bad_response&);
+	}
+}
+
+#if defined(H2C_TEST_SERVER)
+
+std::string h2c_host = "http://localhost:8081/";
+
+TEST_CASE("h2c prior knowledge", "[network]")
+{
+	// the first stream to the port, on a connection of its own
+	auto req = httpverbs::request("ECHO", h2c_host);
+	req.use_h2c().stream_weight(16);
+	req.headers.add("X-Stream", "0");
+	req.content = "Tyger Tyger, burning bright";
+
+	auto resp = req.perform();
+
+	REQUIRE(resp.status_code == 200);
+	REQUIRE(resp.content == req.content);
+	REQUIRE(resp.headers.get("x-stream") == std::string("0"));
+}
+
+// the event loops' pools connected to localhost
+static
+unsigned long long loops_connected()
+{
+	unsigned long long n = 0;
+
+	for (auto&& st : httpverbs::pool_connection_stats())
+		if (st.kind == httpverbs::connection_stats::per_loop and
+		    st.host == "localhost")
+			n += st.created;
+
+	return n;
+}
+
+// unlike h2c, which libcurl 7.88 cannot multiplex
+TEST_CASE("h2 multiplexing over TLS", "[network]")
+{
+	httpverbs::enable_library e("tests/test_server.crt");
+
+	auto before = loops_connected();
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 5; ++i)
+	{
+		reqs.push_back(httpverbs::request("ECHO",
+		    "https://localhost:8444/"));
+		reqs.back().use_http2();
+		reqs.back().headers.add("X-Stream", std::to_string(i));
+		reqs.back().content = std::string(i + 1, 'x');
+	}
+
+	for (auto&& req : reqs)
+		futs.push_back(req.perform_async());
+
+	for (int i = 0; i < 5; ++i)
+	{
+		auto resp = futs[i].get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == reqs[i].content);
+		REQUIRE(resp.headers.get("x-stream") == std::to_string(i));
+	}
+
+	// the streams waited for the first connection, and share it
+	// with the next one too
+	auto req = httpverbs::request("GET", "https://localhost:8444/");
+	REQUIRE(req.use_http2().perform_async().get().status_code == 200);
+
+	auto connected = loops_connected() - before;
+	REQUIRE(connected == 1u);
+}
+
+#endif
+
+#if defined(H2C_CONNECTION_REUSE)
+
+TEST_CASE("h2c multiplexing", "[network]")
+{
+
+	httpverbs::pool_options opts;
+	opts.max_host_connections = 1;
+
+	httpverbs::enable_library e(opts);
+
+	std::vector<httpverbs::request> reqs;
+	std::vector<std::future<httpverbs::response>> futs;
+
+	for (int i = 0; i < 20; ++i)
+	{
+		reqs.push_back(httpverbs::request("ECHO", h2c_host));
+		reqs.back().use_h2c().stream_weight(i + 1);
+		reqs.back().headers.add("X-Stream", std::to_string(i));
+		reqs.back().content = std::string(i + 1, 'x');
+	}
+
+	for (auto&& req : reqs)
+		futs.push_back(req.perform_async());
+
+	for (int i = 0; i < 20; ++i)
+	{
+		auto resp = futs[i].get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == reqs[i].content);
+		REQUIRE(resp.headers.get("x-stream") == std::to_string(i));
+	}
+}
+
+#endif
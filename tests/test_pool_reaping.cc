@@ -0,0 +1,47 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+#include "../src/config.h"
+
+#include <thread>
+#include <chrono>
+
+httpverbs::enable_library _;
+
+// only the per-thread pools of their own are reaped
+#if defined(PER_THREAD_CACHE) && !defined(SHARED_CACHE)
+
+TEST_CASE("idle pools reaped", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.max_idle_time = std::chrono::seconds(1);
+	opts.max_connection_age = std::chrono::seconds(30);
+	opts.max_idle_connections = 4;
+
+	httpverbs::enable_library e(opts);
+
+	auto blocking_pools = []
+	    {
+		size_t n = 0;
+
+		for (auto&& st : httpverbs::pool_connection_stats())
+			if (st.kind == httpverbs::connection_stats::per_thread)
+				++n;
+
+		return n;
+	    };
+
+	httpverbs::get("http://localhost:8080/");
+	REQUIRE(blocking_pools() != 0u);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+	REQUIRE(blocking_pools() == 0u);
+
+	// comes back on demand
+	httpverbs::get("http://localhost:8080/");
+	REQUIRE(blocking_pools() != 0u);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <future>
+#include <chrono>
+
+httpverbs::enable_library _;
+
+TEST_CASE("per-host rate limits", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.host_rate = httpverbs::rate_limit(20, 2);
+	opts.host_rates["127.0.0.1"] = httpverbs::rate_limit();
+
+	httpverbs::enable_library e(opts);
+
+	std::vector<httpverbs::request> reqs;
+
+	for (int i = 0; i < 6; ++i)
+		reqs.push_back(httpverbs::request("OPTIONS",
+		    "http://LOCALHOST:8080/"));
+
+	auto start = std::chrono::steady_clock::now();
+
+	// two at once, then one every 50ms
+	auto expected = std::chrono::milliseconds(4 * 50);
+
+	SECTION("blocking")
+	{
+		for (auto&& req : reqs)
+			REQUIRE(req.perform().status_code == 200);
+	}
+
+	SECTION("batch")
+	{
+		for (auto&& resp : httpverbs::perform_all(reqs))
+			REQUIRE(resp.status_code == 200);
+	}
+
+	SECTION("asynchronous")
+	{
+		std::vector<std::future<httpverbs::response>> futs;
+
+		for (auto&& req : reqs)
+			futs.push_back(req.perform_async());
+
+		for (auto&& fut : futs)
+			REQUIRE(fut.get().status_code == 200);
+	}
+
+	SECTION("unlimited host")
+	{
+		for (auto&& req : reqs)
+			req.url = "http://127.0.0.1:8080/";
+
+		for (auto&& resp : httpverbs::perform_all(reqs))
+			REQUIRE(resp.status_code == 200);
+
+		expected = std::chrono::milliseconds(0);
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(elapsed >= expected);
+
+	if (expected == std::chrono::milliseconds(0))
+		REQUIRE(elapsed < std::chrono::milliseconds(200));
+}
+
+TEST_CASE("host rates in any case", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.host_rates["LocalHost"] = httpverbs::rate_limit(20, 2);
+
+	httpverbs::enable_library e(opts);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < 6; ++i)
+		REQUIRE(httpverbs::request("OPTIONS",
+		    "http://localhost:8080/").perform().status_code == 200);
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(elapsed >= std::chrono::milliseconds(4 * 50));
+}
+
+TEST_CASE("rate tokens past the deadline", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.host_rate = httpverbs::rate_limit(2, 1);
+
+	httpverbs::enable_library e(opts);
+
+	auto url = std::string("http://localhost:8080/");
+
+	REQUIRE(httpverbs::request("OPTIONS", url).perform().status_code ==
+	    200);
+
+	// could start only 500ms later, so it takes no token
+	auto req = httpverbs::request("OPTIONS", url);
+	req.timeout(std::chrono::milliseconds(100));
+
+	REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+
+	auto start = std::chrono::steady_clock::now();
+
+	REQUIRE(httpverbs::request("OPTIONS", url).perform().status_code ==
+	    200);
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(elapsed < std::chrono::milliseconds(800));
+}
+
+TEST_CASE("paced batches keep their connections", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.host_rate = httpverbs::rate_limit(20, 1);
+
+	httpverbs::enable_library e(opts);
+
+	std::vector<httpverbs::request> reqs;
+
+	for (int i = 0; i < 2; ++i)
+		reqs.push_back(httpverbs::request("OPTIONS",
+		    "http://localhost:8080/keep-alive/"));
+
+	// one at a time, so one connection serves them all
+	for (int i = 0; i < 2; ++i)
+		for (auto&& resp : httpverbs::perform_all(reqs))
+			REQUIRE(resp.status_code == 200);
+
+	REQUIRE(httpverbs::get("http://localhost:8080/keep-alive/")
+	    .status_code == 404);
+
+	unsigned long long created = 0, reused = 0;
+
+	for (auto&& st : httpverbs::pool_connection_stats())
+	{
+		if (st.kind == httpverbs::connection_stats::per_loop or
+		    st.host != "localhost")
+			continue;
+
+		created += st.created;
+		reused += st.reused;
+	}
+
+	REQUIRE(created == 1u);
+	REQUIRE(reused == 4u);
+}
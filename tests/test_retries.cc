@@ -0,0 +1,129 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <chrono>
+
+httpverbs::enable_library _;
+
+TEST_CASE("retries", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.retries.max_retries = 2;
+	opts.retries.base_delay = std::chrono::milliseconds(10);
+
+	httpverbs::enable_library e(opts);
+
+	SECTION("blocking")
+	{
+		auto resp = httpverbs::get(
+		    "http://localhost:8080/unavailable-once/a");
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == "available");
+	}
+
+	SECTION("asynchronous")
+	{
+		auto req = httpverbs::request("GET",
+		    "http://localhost:8080/unavailable-once/b");
+		auto resp = req.perform_async().get();
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == "available");
+	}
+
+	// even a POST, which was never sent
+	SECTION("refused connections")
+	{
+		auto req = httpverbs::request("POST", "http://127.0.0.1:1/");
+		req.content = "Tyger Tyger, burning bright";
+
+		REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+		REQUIRE(httpverbs::transfer_retry_stats().retried == 2u);
+		return;
+	}
+
+	REQUIRE(httpverbs::transfer_retry_stats().retried == 1u);
+}
+
+TEST_CASE("stale connections", "[network]")
+{
+	httpverbs::enable_library e;
+
+	// large enough for libcurl to wait for 100 Continue
+	auto req = httpverbs::request("GET", "http://localhost:8080/stale/");
+	req.content = std::string(4 << 20, 'x');
+
+	SECTION("blocking")
+	{
+		REQUIRE(req.perform().content == "fresh");
+		REQUIRE(req.perform().content == "fresh");
+	}
+
+	SECTION("asynchronous")
+	{
+		REQUIRE(req.perform_async().get().content == "fresh");
+		REQUIRE(req.perform_async().get().content == "fresh");
+	}
+
+	REQUIRE(httpverbs::transfer_retry_stats().replayed == 1u);
+}
+
+TEST_CASE("rejected requests", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.retries.max_retries = 2;
+	opts.retries.base_delay = std::chrono::milliseconds(10);
+	opts.retries.max_delay = std::chrono::milliseconds(1000);
+
+	SECTION("waiting as told")
+	{
+		httpverbs::enable_library e(opts);
+
+		auto resp = httpverbs::get(
+		    "http://localhost:8080/rejected-once/g1/1");
+
+		REQUIRE(resp.status_code == 200);
+		REQUIRE(resp.content == "accepted");
+		REQUIRE(httpverbs::transfer_retry_stats().retried == 1u);
+	}
+
+	SECTION("told to wait too long")
+	{
+		httpverbs::enable_library e(opts);
+
+		auto resp = httpverbs::get(
+		    "http://localhost:8080/rejected-once/g2/5");
+
+		REQUIRE(resp.status_code == 429);
+		REQUIRE(httpverbs::transfer_retry_stats().retried == 0u);
+	}
+
+	SECTION("not idempotent")
+	{
+		httpverbs::enable_library e(opts);
+
+		auto req = httpverbs::request("POST",
+		    "http://localhost:8080/rejected-once/p1");
+		req.content = "In what furnace was thy brain?";
+
+		REQUIRE(req.perform().status_code == 429);
+		REQUIRE(httpverbs::transfer_retry_stats().retried == 0u);
+	}
+
+	SECTION("not idempotent, but opted in")
+	{
+		opts.retries.retry_rejected = true;
+		httpverbs::enable_library e(opts);
+
+		auto req = httpverbs::request("POST",
+		    "http://localhost:8080/rejected-once/p2");
+		req.content = "In what furnace was thy brain?";
+
+		REQUIRE(req.perform().status_code == 200);
+		REQUIRE(httpverbs::transfer_retry_stats().retried == 1u);
+	}
+}
@@ -1,26 +1,82 @@
 #!/usr/bin/env python
 
+import time
+import socket
+import struct
+
 try:
     from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+    from SocketServer import ThreadingMixIn
 
 except ImportError:
     from http.server import HTTPServer, BaseHTTPRequestHandler
+    from socketserver import ThreadingMixIn
+
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
 
 
 class StoreHandler(BaseHTTPRequestHandler):
+    # answers Expect: 100-continue, rather than letting the client
+    # time out on it, but still one request per connection, except
+    # under /keep-alive/ and /stale/
+    protocol_version = "HTTP/1.1"
     __db = {}
+    __stalled = set()
+
+    def end_headers(self):
+        if not self.path.startswith(("/keep-alive/", "/stale/")):
+            self.send_header("Connection", "close")
+        BaseHTTPRequestHandler.end_headers(self)
+
+    # so that the responses to the same request compare equal, even
+    # across a second boundary
+    def date_time_string(self, timestamp=None):
+        return "Mon, 01 Jan 2001 00:00:00 GMT"
 
     def do_GET(self):
         try:
+            if self.path.startswith("/stale/"):
+                self.__stale()
+                return
+
             if self.__redirected_to_lower():
                 return
 
+            # the first GET of each /stall-once/ path takes 2 seconds
+            if self.path.startswith("/stall-once/"):
+                first = self.path not in self.__stalled
+                self.__stalled.add(self.path)
+
+                if first:
+                    time.sleep(2)
+
+                self.__db[self.path[1:]] = b"slow" if first else b"fast"
+
+            # the first GET of each /unavailable-once/ path gets a 503
+            if self.path.startswith("/unavailable-once/"):
+                if self.path not in self.__stalled:
+                    self.__stalled.add(self.path)
+                    self.send_response(503)
+                    self.send_header("Content-Length", 0)
+                    self.end_headers()
+                    return
+
+                self.__db[self.path[1:]] = b"available"
+
+            if self.path.startswith("/rejected-once/"):
+                if self.__rejected_once():
+                    return
+
+                self.__db[self.path[1:]] = b"accepted"
+
             s = self.__db[self.path[1:]]
             self.send_response(200)
 
             self.send_header("Content-Type", "text/plain")
             self.send_header("Content-Length", len(s))
-            self.send_header("Content-Encoding", "unknown")
+            self.send_header("Content-Encoding", "identity")
             self.end_headers()
 
             self.wfile.write(s)
@@ -31,6 +87,10 @@ class StoreHandler(BaseHTTPRequestHandler):
             self.end_headers()
 
     def do_HEAD(self):
+        # every HEAD of a /stall/ path takes 2 seconds
+        if self.path.startswith("/stall/"):
+            time.sleep(2)
+
         if self.path[1:] in self.__db:
             self.send_response(200)
 
@@ -73,11 +133,60 @@ class StoreHandler(BaseHTTPRequestHandler):
         self.__set_allowed()
 
     def do_POST(self):
+        if self.path.startswith("/rejected-once/"):
+            self.rfile.read(int(self.headers.get("content-length") or 0))
+
+            if not self.__rejected_once():
+                self.send_response(200)
+                self.send_header("Content-Length", 0)
+                self.end_headers()
+
+            return
+
         if self.__redirected_to_lower():
             return
 
         self.__not_allowed()
 
+    # A connection to /stale/ answers its first GET and stays open;
+    # the next GET on it is reset halfway through the request body, as
+    # if the server had closed the connection while it was idle.
+    def __stale(self):
+        sz = int(self.headers.get("content-length") or 0)
+
+        if getattr(self, "kept_alive", False):
+            self.rfile.read(min(sz, 65536))
+            self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                                       struct.pack("ii", 1, 0))
+            self.close_connection = True
+            return
+
+        self.rfile.read(sz)
+        self.kept_alive = True
+        self.send_response(200)
+        self.send_header("Content-Length", 5)
+        self.end_headers()
+        self.wfile.write(b"fresh")
+
+    # the first request to each /rejected-once/ path gets a 429, with
+    # a Retry-After of the last path segment, if it is a number
+    def __rejected_once(self):
+        if self.path in self.__stalled:
+            return False
+
+        self.__stalled.add(self.path)
+        self.send_response(429)
+
+        after = self.path.rsplit("/", 1)[-1]
+
+        if after.isdigit():
+            self.send_header("Retry-After", after)
+
+        self.send_header("Content-Length", 0)
+        self.end_headers()
+
+        return True
+
     def __redirected_to_lower(self):
         pe = self.path.lower()
 
@@ -108,9 +217,9 @@ class StoreHandler(BaseHTTPRequestHandler):
 
         self.send_response(200)
 
-        for h in self.headers.headers:
-            if h[:2].lower() == "x-":
-                self.wfile.write(h)
+        for k, v in self.headers.items():
+            if k[:2].lower() == "x-":
+                self.send_header(k, v)
 
         self.send_header("Content-Length", sz)
         self.end_headers()
@@ -122,9 +231,120 @@ class StoreHandler(BaseHTTPRequestHandler):
         self.wfile.write(self.rfile.read(sz))
 
 
+def serve_h2c(port, tls=False):
+    """Cleartext HTTP/2 with prior knowledge, or with `tls`, HTTP/2 by
+    ALPN; every method echoes the request body back, and the x-
+    headers along with it."""
+
+    import os
+    import socket
+    import ssl
+    import threading
+    import h2.config
+    import h2.connection
+    import h2.events
+
+    def respond(conn, stream_id, headers, body):
+        hs = [(":status", "200"), ("content-length", str(len(body)))]
+        hs += [(k, v) for k, v in headers if k[:2] == "x-"]
+        conn.send_headers(stream_id, hs)
+        conn.send_data(stream_id, body, end_stream=True)
+
+    def handle(sock):
+        if tls:
+            sock = ctx.wrap_socket(sock, server_side=True)
+
+        conn = h2.connection.H2Connection(h2.config.H2Configuration(
+            client_side=False, header_encoding="utf-8"))
+        conn.initiate_connection()
+        sock.sendall(conn.data_to_send())
+        streams = {}
+
+        while True:
+            data = sock.recv(65536)
+            if not data:
+                break
+
+            for ev in conn.receive_data(data):
+                if isinstance(ev, h2.events.RequestReceived):
+                    streams[ev.stream_id] = (ev.headers, [])
+
+                elif isinstance(ev, h2.events.DataReceived):
+                    streams[ev.stream_id][1].append(ev.data)
+                    conn.acknowledge_received_data(
+                        ev.flow_controlled_length, ev.stream_id)
+
+                elif isinstance(ev, h2.events.StreamEnded):
+                    headers, chunks = streams.pop(ev.stream_id)
+                    respond(conn, ev.stream_id, headers,
+                            b"".join(chunks))
+
+            sock.sendall(conn.data_to_send())
+
+        sock.close()
+
+    if tls:
+        here = os.path.dirname(os.path.abspath(__file__))
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(os.path.join(here, "test_server.crt"),
+                            os.path.join(here, "test_server.key"))
+        ctx.set_alpn_protocols(["h2"])
+
+    ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(("localhost", port))
+    ls.listen(64)
+
+    while True:
+        sock, _ = ls.accept()
+        th = threading.Thread(target=handle, args=(sock,))
+        th.daemon = True
+        th.start()
+
+
+def serve_tls(port):
+    """The same store over HTTPS, with the certificate next to this
+    script, which names localhost."""
+
+    import os
+    import ssl
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    ctx.load_cert_chain(os.path.join(here, "test_server.crt"),
+                        os.path.join(here, "test_server.key"))
+
+    server = ThreadingHTTPServer(('localhost', port), StoreHandler)
+    server.socket = ctx.wrap_socket(server.socket, server_side=True)
+    server.serve_forever()
+
+
 def main():
+    import threading
+
     port = 8080
-    server = HTTPServer(('localhost', port), StoreHandler)
+    server = ThreadingHTTPServer(('localhost', port), StoreHandler)
+
+    th = threading.Thread(target=serve_tls, args=(8443,))
+    th.daemon = True
+    th.start()
+
+    # the HTTP/2 modes need the h2 package; the tests which use them are
+    # compiled in only if it is installed
+    try:
+        import h2
+
+        th = threading.Thread(target=serve_h2c, args=(port + 1,))
+        th.daemon = True
+        th.start()
+
+        th = threading.Thread(target=serve_h2c, args=(8444, True))
+        th.daemon = True
+        th.start()
+
+    except ImportError:
+        pass
+
     server.serve_forever()
 
 
@@ -0,0 +1,103 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+#include "../src/socket_tuning.h"
+
+#include <memory>
+
+#if !defined(WIN32)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+httpverbs::enable_library _;
+
+TEST_CASE("socket options", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.sockets.keepalive = true;
+	opts.sockets.keepalive_idle = std::chrono::seconds(30);
+	opts.sockets.keepalive_interval = std::chrono::seconds(10);
+	opts.sockets.receive_buffer = 4 << 20;
+	opts.sockets.send_buffer = 4 << 20;
+	opts.sockets.busy_poll = std::chrono::microseconds(50);
+	opts.sockets.happy_eyeballs = std::chrono::milliseconds(100);
+
+	httpverbs::enable_library e(opts);
+
+	auto req = httpverbs::request("PUT",
+	    "http://localhost:8080/tuned");
+	req.content = std::string(1 << 20, 'x');
+
+	REQUIRE(req.perform().status_code == 201);
+	REQUIRE(httpverbs::get("http://localhost:8080/tuned").content ==
+	    req.content);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x072d00 && !defined(WIN32)
+
+static
+size_t discard(char*, size_t size, size_t nmemb, void*)
+{
+	return size * nmemb;
+}
+
+// the connection stays open after a /keep-alive/ response, so its
+// options can be read back
+TEST_CASE("socket options applied", "[network]")
+{
+	httpverbs::socket_options opts;
+	opts.receive_buffer = 16 << 10;
+
+	std::unique_ptr<CURL, void (*)(CURL*)> h(curl_easy_init(),
+	    curl_easy_cleanup);
+	curl_easy_setopt(h.get(), CURLOPT_URL,
+	    "http://localhost:8080/keep-alive/tuned");
+	curl_easy_setopt(h.get(), CURLOPT_WRITEFUNCTION, discard);
+
+	SECTION("no delay")
+	{
+		httpverbs::tune_sockets(h.get(), opts);
+		REQUIRE(curl_easy_perform(h.get()) == CURLE_OK);
+
+		curl_socket_t fd;
+		REQUIRE(curl_easy_getinfo(h.get(), CURLINFO_ACTIVESOCKET,
+		    &fd) == CURLE_OK);
+
+		int v = 0;
+		socklen_t len = sizeof(v);
+		REQUIRE(getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &v,
+		    &len) == 0);
+		REQUIRE(v != 0);
+
+		// which Linux reports doubled
+		v = 0;
+		len = sizeof(v);
+		REQUIRE(getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &v, &len) == 0);
+		REQUIRE(v >= opts.receive_buffer);
+		REQUIRE(v <= 2 * opts.receive_buffer);
+	}
+
+	SECTION("Nagle")
+	{
+		opts.no_delay = false;
+		httpverbs::tune_sockets(h.get(), opts);
+		REQUIRE(curl_easy_perform(h.get()) == CURLE_OK);
+
+		curl_socket_t fd;
+		REQUIRE(curl_easy_getinfo(h.get(), CURLINFO_ACTIVESOCKET,
+		    &fd) == CURLE_OK);
+
+		int v = 1;
+		socklen_t len = sizeof(v);
+		REQUIRE(getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &v,
+		    &len) == 0);
+		REQUIRE(v == 0);
+	}
+}
+
+#endif
@@ -0,0 +1,81 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <vector>
+#include <chrono>
+
+httpverbs::enable_library _;
+
+TEST_CASE("time limits", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.timeout = std::chrono::milliseconds(300);
+
+	httpverbs::enable_library e(opts);
+
+	auto start = std::chrono::steady_clock::now();
+
+	SECTION("by default")
+	{
+		REQUIRE_THROWS_AS(httpverbs::get(
+		    "http://localhost:8080/stall-once/t1"),
+		    httpverbs::bad_response&);
+	}
+
+	SECTION("asynchronous")
+	{
+		auto req = httpverbs::request("GET",
+		    "http://localhost:8080/stall-once/t2");
+
+		REQUIRE_THROWS_AS(req.perform_async().get(),
+		    httpverbs::bad_response&);
+	}
+
+	SECTION("first byte")
+	{
+		auto req = httpverbs::request("GET",
+		    "http://localhost:8080/stall-once/t3");
+		req.timeout(std::chrono::milliseconds(0));
+		req.first_byte_timeout(std::chrono::milliseconds(300));
+
+		REQUIRE_THROWS_AS(req.perform(), httpverbs::bad_response&);
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	REQUIRE(elapsed < std::chrono::seconds(1));
+
+	// a fast response is well within the limits
+	auto req = httpverbs::request("GET",
+	    "http://localhost:8080/stall-once/t4");
+	req.timeout(std::chrono::seconds(5));
+	req.first_byte_timeout(std::chrono::seconds(5));
+
+	REQUIRE(req.perform().status_code == 200);
+}
+
+TEST_CASE("batch past a deadline", "[network]")
+{
+	std::vector<httpverbs::request> reqs;
+
+	reqs.push_back(httpverbs::request("PUT",
+	    "http://localhost:8080/too-late"));
+	reqs.back().content = "When the stars threw down their spears";
+	reqs.back().deadline(std::chrono::steady_clock::now() -
+	    std::chrono::seconds(1));
+
+	reqs.push_back(httpverbs::request("PUT",
+	    "http://localhost:8080/in-time"));
+	reqs.back().content = "And water'd heaven with their tears";
+
+	// the late one fails, but alone
+	REQUIRE_THROWS_AS(httpverbs::perform_all(reqs),
+	    httpverbs::bad_response&);
+	REQUIRE(httpverbs::get("http://localhost:8080/too-late").status_code ==
+	    404);
+	REQUIRE(httpverbs::get("http://localhost:8080/in-time").content ==
+	    reqs[1].content);
+}
@@ -0,0 +1,105 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <httpverbs/httpverbs.h>
+#include <httpverbs/exceptions.h>
+
+#include <chrono>
+#include <thread>
+
+httpverbs::enable_library _;
+
+// the pools of the event loops, or the blocking ones
+static
+httpverbs::connection_stats to_localhost(bool loops)
+{
+	httpverbs::connection_stats total = {};
+
+	for (auto&& st : httpverbs::pool_connection_stats())
+	{
+		bool loop = st.kind == httpverbs::connection_stats::per_loop;
+
+		if (loop != loops or st.host != "localhost")
+			continue;
+
+		total.open += st.open;
+		total.idle += st.idle;
+		total.created += st.created;
+		total.reused += st.reused;
+	}
+
+	return total;
+}
+
+TEST_CASE("warm up", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.warm_urls.push_back("http://localhost:8080/keep-alive/");
+	opts.warm_connections = 2;
+	opts.track_sockets = true;
+
+	httpverbs::enable_library e(opts);
+
+	// parked in the event loops' pools
+	auto st = to_localhost(true);
+	REQUIRE(st.created == 2u);
+	REQUIRE(st.idle == 2u);
+
+	// and in this thread's
+	st = to_localhost(false);
+	REQUIRE(st.created == 2u);
+	REQUIRE(st.idle == 2u);
+
+	REQUIRE(httpverbs::get("http://localhost:8080/keep-alive/")
+	    .status_code == 404);
+
+	st = to_localhost(false);
+	REQUIRE(st.created == 2u);
+	REQUIRE(st.reused == 1u);
+
+	REQUIRE(httpverbs::warm_up({ "http://localhost:8080/",
+	    "http://127.0.0.1:1/" }, 3) == 3u);
+}
+
+TEST_CASE("rewarm", "[network]")
+{
+	httpverbs::pool_options opts;
+	opts.warm_urls.push_back("http://localhost:8080/keep-alive/");
+	opts.warm_connections = 2;
+	opts.rewarm_interval = std::chrono::seconds(1);
+	opts.track_sockets = true;
+
+	httpverbs::enable_library e(opts);
+
+	REQUIRE(to_localhost(true).idle == 2u);
+
+	// the server closes the connections after these
+	auto r1 = httpverbs::request("OPTIONS", "http://localhost:8080/");
+	auto r2 = httpverbs::request("OPTIONS", "http://localhost:8080/");
+	auto f1 = r1.perform_async();
+	auto f2 = r2.perform_async();
+	REQUIRE(f1.get().status_code == 200);
+	REQUIRE(f2.get().status_code == 200);
+
+	REQUIRE(to_localhost(true).idle < 2u);
+
+	// a round may be under way as they close; give it two more
+	auto deadline = std::chrono::steady_clock::now() +
+	    std::chrono::seconds(3);
+	while (to_localhost(true).idle < 2u and
+	    std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	REQUIRE(to_localhost(true).idle == 2u);
+}
+
+TEST_CASE("warm up in time", "[network]")
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	REQUIRE(httpverbs::warm_up({ "http://localhost:8080/stall/warm" },
+	    1, std::chrono::milliseconds(300)) == 0u);
+	bool in_time = std::chrono::steady_clock::now() - t0 <
+	    std::chrono::seconds(1);
+	REQUIRE(in_time);
+}